@@ -40,7 +40,57 @@ START_POS = [sum(N_INSTANCES[:i]) for i in range(len(N_INSTANCES))]
 MAX_TRIALS = int(3e6)
 
 
+# Binary file written by extract_features: a header, then per position the
+# weight index of every pattern instance and the final score, in x86 byte order
+# (see src/training_data.h).
+FEATURES_MAGIC = b"WKFT"
+FEATURES_VERSION = 1
+FEATURES_HEADER = np.dtype([
+    ("magic", "S4"),
+    ("version", "<u4"),
+    ("n_indices", "<u4"),
+    ("n_weights", "<u4"),
+    ("n_positions", "<u8"),
+])
+
+
+def is_features_file(filename):
+    with open(filename, "rb") as f:
+        return f.read(len(FEATURES_MAGIC)) == FEATURES_MAGIC
+
+
+def load_features(filename):
+    header = np.fromfile(filename, dtype=FEATURES_HEADER, count=1)[0]
+    n_params = sum(N_INSTANCES)
+    if header["version"] != FEATURES_VERSION or header["n_weights"] != n_params:
+        raise ValueError(f"{filename} was made for another pattern set or version")
+
+    record = np.dtype([("idx", "<u2", (int(header["n_indices"]),)), ("score", "<i2")])
+    records = np.fromfile(filename, dtype=record, count=int(header["n_positions"]),
+                          offset=FEATURES_HEADER.itemsize)
+
+    if len(records) > MAX_TRIALS:
+        records = records[np.random.choice(len(records), MAX_TRIALS, replace=False)]
+
+    # Only make weights for non-empty instances, as for text input: an empty
+    # instance is the first weight of its pattern.
+    idx = records["idx"]
+    nonempty = ~np.isin(idx, START_POS)
+
+    indices = idx[nonempty].astype(np.int32)
+    indptr = np.concatenate(([0], np.cumsum(np.count_nonzero(nonempty, axis=1))))
+    data = np.ones(len(indices))
+
+    a = csr_matrix((data, indices, indptr), shape=(len(records), n_params))
+    b = (records["score"] > 0).astype(int)
+    return a, b
+
+
 def train(filename):
+    if is_features_file(filename):
+        print("Loading features...")
+        a, b = load_features(filename)
+        return fit(a, b)
 
     file = open(filename)
     all_lines = file.readlines()
@@ -82,6 +132,10 @@ def train(filename):
 
     bar.finish()
 
+    return fit(a, b)
+
+
+def fit(a, b):
     print("Scaling...")
     scaler = MaxAbsScaler()
     a_std = scaler.fit_transform(a)
@@ -113,6 +167,6 @@ if __name__ == "__main__":
 
     print("Writing weights to file...")
     with open("weights.txt", "w") as outfile:
-        outfile.write(str(int(intercept)) + "\n")
+        outfile.write(str(int(intercept[0])) + "\n")
         for w in weights[0]:
             outfile.write(str(int(w)) + "\n")
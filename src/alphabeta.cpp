@@ -18,33 +18,114 @@ const int PROBCUT_MARGIN = 100;
 const int STATIC_EVAL_MARGIN_SHALLOW = 300;
 
 
+/**
+ * Hashtable lookup that keeps count of probes and hits.
+ */
+bool tt_get(SearchInfo &si, uint64_t key, SearchNode &entry, bool include_stale = false) {
+    si.tt_probes++;
+    if (!si.ht->get(key, entry, include_stale)) return false;
+    si.tt_hits++;
+    return true;
+}
+
+
+/**
+ * Full-board evaluation that goes through the thread's eval cache, if it has
+ * one, and keeps count of probes and hits.
+ *
+ * Boards with pattern indices are evaluated without the cache: summing their
+ * weights costs about as much as a probe, and only a third of them hit.
+ */
+int cached_score(board::Board b, SearchInfo &si) {
+    if (!si.ec) return eval::score(b);
+
+    uint64_t key = EvalCache::hash(b);
+    int score;
+    si.eval_probes++;
+    if (si.ec->get(key, score)) {
+        si.eval_hits++;
+        return score;
+    }
+
+    score = eval::score(b);
+    si.ec->set(key, score);
+    return score;
+}
+
+
+/**
+ * Like eval::score_batch, with the boards missing from the eval cache
+ * evaluated together.
+ */
+void cached_score_batch(const board::Board *boards, int n, int *scores, SearchInfo &si) {
+    if (!si.ec) {
+        eval::score_batch(boards, n, scores);
+        return;
+    }
+
+    uint64_t keys[64];
+    board::Board misses[64];
+    int miss_idx[64];
+    int n_misses = 0;
+    for (int i = 0; i < n; i++) {
+        keys[i] = EvalCache::hash(boards[i]);
+        if (si.ec->get(keys[i], scores[i])) continue;
+        misses[n_misses] = boards[i];
+        miss_idx[n_misses] = i;
+        n_misses++;
+    }
+    si.eval_probes += n;
+    si.eval_hits += n - n_misses;
+
+    int miss_scores[64];
+    eval::score_batch(misses, n_misses, miss_scores);
+    for (int j = 0; j < n_misses; j++) {
+        scores[miss_idx[j]] = miss_scores[j];
+        si.ec->set(keys[miss_idx[j]], miss_scores[j]);
+    }
+}
+
+
 SearchNode ab_deep(board::Board b, int alpha, int beta, int depth, bool passed, SearchInfo &si) {
+    return ab_deep(hashed(b), alpha, beta, depth, passed, si);
+}
+
+
+SearchNode ab_deep(const HashedBoard &hb, int alpha, int beta, int depth, bool passed, SearchInfo &si) {
     si.nodes++;
 
-    // Check hashtable to avoid re-search.
-    SearchNode *table_entry = si.ht->get(b);
-    if (table_entry && table_entry->depth >= depth) {
-        // If score is exact, return it.
-        if (table_entry->type == NodeType::PV) return *table_entry;
+    board::Board b = hb.b;
+
+    // Check hashtable to avoid re-search, or failing that for a move to try
+    // first.
+    SearchNode table_entry;
+    int table_move = MOVE_NULL;
+    if (tt_get(si, hb.key, table_entry)) {
+        if (table_entry.depth >= depth) {
+            // If score is exact, return it.
+            if (table_entry.type == NodeType::PV) return table_entry;
 
-        // If score is lower bound, check for beta cutoff.
-        if (table_entry->type == NodeType::HIGH && table_entry->score >= beta)
-            return {depth, NodeType::HIGH, table_entry->score, table_entry->best_move};
+            // If score is lower bound, check for beta cutoff.
+            if (table_entry.type == NodeType::HIGH && table_entry.score >= beta)
+                return {depth, NodeType::HIGH, table_entry.score, table_entry.best_move};
 
-        // If score is upper bound, check for alpha cutoff.
-        if (table_entry->type == NodeType::LOW && table_entry->score <= alpha)
-            return {depth, NodeType::LOW, table_entry->score, table_entry->best_move};
+            // If score is upper bound, check for alpha cutoff.
+            if (table_entry.type == NodeType::LOW && table_entry.score <= alpha)
+                return {depth, NodeType::LOW, table_entry.score, table_entry.best_move};
+        }
+
+        table_move = table_entry.best_move;
     }
 
     if (depth == 0) {
-        int score = eval::score(b);
+        int score = cached_score(b, si);
         if (score > beta) return {depth, NodeType::HIGH, beta, -1};
         if (score < alpha) return {depth, NodeType::LOW, alpha, -1};
         return {depth, NodeType::PV, score, MOVE_NULL};
     }
 
-    // Check for timeout.
-    if (get_time_since(si.start) >= si.time_limit) {
+    // Check for timeout, or for another thread telling us to stop.
+    if (get_time_since(si.start) >= si.time_limit || (si.stop && si.stop->load(memory_order_relaxed))) {
         return {depth, NodeType::TIMEOUT, 0, MOVE_NULL};
     }
 
@@ -54,54 +135,101 @@ SearchNode ab_deep(board::Board b, int alpha, int beta, int depth, bool passed,
 
         if (alpha != -INT_MAX) {
             int bound_low = alpha - PROBCUT_MARGIN;
-            SearchNode prob_low = ab_deep(b, bound_low, bound_low + 1, prob_depth, passed, si);
+            SearchNode prob_low = ab_deep(hb, bound_low, bound_low + 1, prob_depth, passed, si);
             if (prob_low.type == NodeType::LOW) return {depth, NodeType::LOW, prob_low.score, MOVE_NULL};
         }
 
         if (beta != INT_MAX) {
             int bound_high = beta + PROBCUT_MARGIN;
-            SearchNode prob_high = ab_deep(b, bound_high - 1, bound_high, prob_depth, passed, si);
+            SearchNode prob_high = ab_deep(hb, bound_high - 1, bound_high, prob_depth, passed, si);
             if (prob_high.type == NodeType::HIGH) return {depth, NodeType::HIGH, prob_high.score, MOVE_NULL};
         }
     }
 
-    int sort_depth = max(0, depth - SORT_DEPTH_REDUCTION);
-    vector<ScoredMove> moves = get_sorted_moves(b, sort_depth, si);
+    uint64_t move_mask = board::get_moves(b);
 
-    if (moves.size() == 0) {
+    if (move_mask == 0ULL) {
         if (passed) { // Game is over: solved node
             int score = INT_MAX * sgn(board::popcount(b.own) - board::popcount(b.opp));
-            si.ht->set(b, {depth, NodeType::PV, score, -1});
+            si.ht->set(hb.key, {depth, NodeType::PV, score, -1});
             return {depth, NodeType::PV, score, -1};
         } else {
             SearchNode result = 
-                ab_deep(board::do_move(b, MOVE_PASS), -beta, -alpha, depth, true, si);
+                ab_deep(do_move(hb, MOVE_PASS), -beta, -alpha, depth, true, si);
             if (result.type == NodeType::TIMEOUT) { // propagate timeouts back up
                 return {depth, NodeType::TIMEOUT, 0, MOVE_NULL};
             }
 
             int score = -result.score;
             if (score > alpha) {
-                si.ht->set(b, {depth, NodeType::PV, score, -1});
+                si.ht->set(hb.key, {depth, NodeType::PV, score, -1});
                 return {depth, NodeType::PV, score, -1};
             } else {
-                si.ht->set(b, {depth, NodeType::LOW, alpha, -1});
+                si.ht->set(hb.key, {depth, NodeType::LOW, alpha, -1});
                 return {depth, NodeType::LOW, alpha, -1};
             }
         }
     }
 
+    // The table move goes first. The other children are only made, checked
+    // for transposition cutoffs and sorted once it has failed to cut off.
+    vector<ScoredMove> moves;
+    bool expanded = false;
+    if (table_move >= 0 && (move_mask & (1ULL << table_move))) {
+        moves.push_back(ScoredMove{table_move, 0, board::do_move(b, table_move)});
+    }
+
     // Search moves with alphabeta algorithm
     int best_move = MOVE_NULL;
     int best_score = alpha;
-    for (auto m : moves) {
+    for (size_t i = 0; ; i++) {
+        if (i == moves.size()) {
+            if (expanded) break;
+            expanded = true;
+
+            HashedBoard children[64];
+            int child_moves[64];
+            int n_children = 0;
+            int n_all = expand_hashed(hb, children, child_moves, si);
+            for (int j = 0; j < n_all; j++) {
+                if (child_moves[j] == table_move) continue;
+                children[n_children] = children[j];
+                child_moves[n_children] = child_moves[j];
+                n_children++;
+            }
+
+            // Enhanced transposition cutoff: a child whose stored upper bound
+            // already gives us a score of beta or more cuts off without
+            // searching. Children of shallower nodes are searched by
+            // ab_medium, which doesn't use the table.
+            if (depth > DEEP_CUTOFF) {
+                for (int j = 0; j < n_children; j++) {
+                    SearchNode child_entry;
+                    if (!tt_get(si, children[j].key, child_entry) || child_entry.depth < depth - 1) continue;
+                    if (child_entry.type != NodeType::PV && child_entry.type != NodeType::LOW) continue;
+
+                    int score = -child_entry.score;
+                    if (score >= beta) {
+                        si.ht->set(hb.key, {depth, NodeType::HIGH, score, child_moves[j]});
+                        return {depth, NodeType::HIGH, score, child_moves[j]};
+                    }
+                }
+            }
+
+            int sort_depth = max(0, depth - SORT_DEPTH_REDUCTION);
+            vector<ScoredMove> rest = sort_children(children, child_moves, n_children, sort_depth, si);
+            moves.insert(moves.end(), rest.begin(), rest.end());
+            if (i == moves.size()) break;
+        }
+        const ScoredMove &m = moves[i];
+
         // Get score
         int score;
 
         if (depth <= DEEP_CUTOFF) {
             score = -ab_medium(m.after, -beta, -best_score, depth - 1, false, si);
         } else {
-            SearchNode result = ab_deep(m.after, -beta, -best_score, depth - 1, false, si);
+            SearchNode result = ab_deep(after_move(hb, m.move, m.after), -beta, -best_score, depth - 1, false, si);
             if (result.type == NodeType::TIMEOUT) { // propagate timeouts back up
                 return {depth, NodeType::TIMEOUT, 0, MOVE_NULL};
             }
@@ -110,7 +238,7 @@ SearchNode ab_deep(board::Board b, int alpha, int beta, int depth, bool passed,
         }
 
         if (score >= beta) {
-            si.ht->set(b, {depth, NodeType::HIGH, score, m.move});
+            si.ht->set(hb.key, {depth, NodeType::HIGH, score, m.move});
             return {depth, NodeType::HIGH, score, m.move};
         }
         if (score > best_score) {
@@ -120,10 +248,10 @@ SearchNode ab_deep(board::Board b, int alpha, int beta, int depth, bool passed,
     }
 
     if (best_score > alpha) {
-        si.ht->set(b, {depth, NodeType::PV, best_score, best_move});
+        si.ht->set(hb.key, {depth, NodeType::PV, best_score, best_move});
         return {depth, NodeType::PV, best_score, best_move};
     } else {
-        si.ht->set(b, {depth, NodeType::LOW, alpha, best_move});
+        si.ht->set(hb.key, {depth, NodeType::LOW, alpha, best_move});
         return {depth, NodeType::LOW, alpha, best_move};
     }
 }
@@ -133,7 +261,7 @@ int ab_medium(board::Board b, int alpha, int beta, int depth, bool passed, Searc
     si.nodes++;
 
     if (depth == 0) {
-        return eval::score(b);
+        return cached_score(b, si);
     }
 
     // Probcut
@@ -154,7 +282,7 @@ int ab_medium(board::Board b, int alpha, int beta, int depth, bool passed, Searc
     }
 
     int sort_depth = max(0, depth - SORT_DEPTH_REDUCTION);
-    vector<ScoredMove> moves = get_sorted_moves(b, sort_depth, si);
+    vector<ScoredMove> moves = get_sorted_moves(hashed(b), sort_depth, si);
 
     if (moves.size() == 0) {
         if (passed) return INT_MAX * sgn(board::popcount(b.own) - board::popcount(b.opp));
@@ -178,15 +306,33 @@ int ab_medium(board::Board b, int alpha, int beta, int depth, bool passed, Searc
 
 
 int ab(board::Board b, int alpha, int beta, int depth, bool passed, SearchInfo &si) {
+    // A lone leaf is cheaper to evaluate from scratch.
+    if (depth == 0) {
+        si.nodes++;
+        return cached_score(b, si);
+    }
+
+    return ab(eval::patterned(b), alpha, beta, depth, passed, si);
+}
+
+
+/**
+ * Shallow search without move ordering, where evaluating the board takes
+ * most of the time. Pattern indices are updated with each move instead of
+ * being worked out at every node.
+ */
+int ab(const eval::PatternBoard &pb, int alpha, int beta, int depth, bool passed, SearchInfo &si) {
     si.nodes++;
 
+    board::Board b = pb.b;
+
     if (depth == 0) {
-        return eval::score(b);
+        return eval::score(pb);
     }
 
     // Static eval pruning
     if (si.forward_prune) {
-        int static_score = eval::score(b);
+        int static_score = eval::score(pb);
         if (static_score - STATIC_EVAL_MARGIN_SHALLOW > beta) {
             return static_score;
         } else if (static_score + STATIC_EVAL_MARGIN_SHALLOW < alpha) {
@@ -198,14 +344,14 @@ int ab(board::Board b, int alpha, int beta, int depth, bool passed, SearchInfo &
 
     if (move_mask == 0ULL) {
         if (passed) return INT_MAX * sgn(board::popcount(b.own) - board::popcount(b.opp));
-        return -ab(board::do_move(b, MOVE_PASS), -beta, -alpha, depth, true, si);
+        return -ab(eval::do_move(pb, MOVE_PASS), -beta, -alpha, depth, true, si);
     }
 
     while (move_mask != 0ULL) {
         int m = __builtin_ctzll(move_mask);
         move_mask &= move_mask - 1;
 
-        int score = -ab(board::do_move(b, m), -beta, -alpha, depth - 1, false, si);
+        int score = -ab(eval::do_move(pb, m), -beta, -alpha, depth - 1, false, si);
 
         if (score >= beta) return score;
         if (score > alpha) alpha = score;
@@ -215,36 +361,79 @@ int ab(board::Board b, int alpha, int beta, int depth, bool passed, SearchInfo &
 }
 
 
-vector<ScoredMove> get_sorted_moves(board::Board b, int depth, SearchInfo &si) {
-    vector<ScoredMove> ret;
-
-    uint64_t move_mask = board::get_moves(b);
+/**
+ * Makes every move of hb and prefetches the children's hashtable buckets, so
+ * the cache misses of later probes overlap instead of coming one by one.
+ * Gives the number of children.
+ */
+int expand_hashed(const HashedBoard &hb, HashedBoard *children, int *moves, SearchInfo &si) {
+    board::Board afters[64];
+    int n_children = 0;
 
+    uint64_t move_mask = board::expand_children(hb.b, afters, nullptr);
     while (move_mask != 0ULL) {
         int m = __builtin_ctzll(move_mask);
         move_mask &= move_mask - 1;
 
-        board::Board after = board::do_move(b, m);
+        moves[n_children] = m;
+        children[n_children] = after_move(hb, m, afters[n_children]);
+        si.ht->prefetch(children[n_children].key);
+        n_children++;
+    }
+
+    return n_children;
+}
+
+
+/**
+ * Scores children by a search to the depth given, or by their exact score
+ * from the hashtable, and sorts them best first.
+ */
+vector<ScoredMove> sort_children(const HashedBoard *children, const int *moves, int n_children, int depth, SearchInfo &si) {
+    vector<ScoredMove> ret;
+
+    // At depth 0 the children are only evaluated, so evaluate them together.
+    int leaf_scores[64];
+    if (depth == 0) {
+        board::Board afters[64];
+        for (int i = 0; i < n_children; i++) afters[i] = children[i].b;
+        cached_score_batch(afters, n_children, leaf_scores, si);
+    }
+
+    for (int i = 0; i < n_children; i++) {
+        const HashedBoard &after = children[i];
 
-        // Check hashtable for stored score. Only take exact scores.
+        // Check hashtable for stored score. Only take exact scores, which may
+        // be left over from a previous search.
         // If none found, search to depth given to get score.
         int score;
-        SearchNode *table_entry = si.ht->get(after);
-        if (table_entry && table_entry->type == NodeType::PV) {
-            score = table_entry->score;
+        SearchNode table_entry;
+        if (tt_get(si, after.key, table_entry, true) && table_entry.type == NodeType::PV) {
+            score = table_entry.score;
         } else {
             if (depth >= DEEP_CUTOFF) {
                 score = ab_deep(after, -INT_MAX, INT_MAX, depth, false, si).score;
             } else if (depth >= MED_CUTOFF) {
-                score = ab_medium(after, -INT_MAX, INT_MAX, depth, false, si);
+                score = ab_medium(after.b, -INT_MAX, INT_MAX, depth, false, si);
+            } else if (depth > 0) {
+                score = ab(after.b, -INT_MAX, INT_MAX, depth, false, si);
             } else {
-                score = ab(after, -INT_MAX, INT_MAX, depth, false, si);
+                si.nodes++;
+                score = leaf_scores[i];
             }
         }
 
-        ret.push_back(ScoredMove{m, score, after});
+        ret.push_back(ScoredMove{moves[i], score, after.b});
     }
 
     std::sort(ret.begin(), ret.end());
     return ret;
 }
+
+
+vector<ScoredMove> get_sorted_moves(const HashedBoard &hb, int depth, SearchInfo &si) {
+    HashedBoard children[64];
+    int moves[64];
+    int n_children = expand_hashed(hb, children, moves, si);
+    return sort_children(children, moves, n_children, depth, si);
+}
@@ -1,23 +1,39 @@
 #include <vector>
-#include <time.h>
+#include <atomic>
 
 #include "board.h"
 #include "common.h"
+#include "eval_cache.h"
 #include "hashtable.h"
+#include "pattern_eval.h"
 
+// Per-thread search state. Threads searching the same position share ht, but
+// each has its own ec. Helper threads are told to give up by setting *stop.
 struct SearchInfo {
     HashTable *ht;
+    EvalCache *ec;  // nullptr to evaluate every board
     long nodes;
-    clock_t start;
+    timestamp start;
     float time_limit;
     bool forward_prune;
+    const atomic<bool> *stop;
+    long tt_probes;
+    long tt_hits;
+    long eval_probes;
+    long eval_hits;
 
-    SearchInfo(HashTable *ht, float time_limit, bool forward_prune) {
+    SearchInfo(HashTable *ht, EvalCache *ec, float time_limit, bool forward_prune, const atomic<bool> *stop = nullptr) {
         this->ht = ht;
+        this->ec = ec;
         this->nodes = 0L;
-        this->start = clock();
+        this->tt_probes = 0L;
+        this->tt_hits = 0L;
+        this->eval_probes = 0L;
+        this->eval_hits = 0L;
+        this->start = get_time();
         this->time_limit = time_limit;
         this->forward_prune = forward_prune;
+        this->stop = stop;
     }
 };
 
@@ -29,7 +45,11 @@ SearchNode ab_deep(
     bool passed,
     SearchInfo &si
 );
+SearchNode ab_deep(const HashedBoard &hb, int alpha, int beta, int depth, bool passed, SearchInfo &si);
 int ab_medium(board::Board b, int alpha, int beta, int depth, bool passed, SearchInfo &si);
 int ab(board::Board b, int alpha, int beta, int depth, bool passed, SearchInfo &si);
+int ab(const eval::PatternBoard &pb, int alpha, int beta, int depth, bool passed, SearchInfo &si);
 
-vector<ScoredMove> get_sorted_moves(board::Board b, int depth, SearchInfo &si);
+int expand_hashed(const HashedBoard &hb, HashedBoard *children, int *moves, SearchInfo &si);
+vector<ScoredMove> sort_children(const HashedBoard *children, const int *moves, int n_children, int depth, SearchInfo &si);
+vector<ScoredMove> get_sorted_moves(const HashedBoard &hb, int depth, SearchInfo &si);
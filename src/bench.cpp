@@ -0,0 +1,478 @@
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <getopt.h>
+#include <fmt/core.h>
+
+#include "alphabeta.h"
+#include "board.h"
+#include "common.h"
+#include "eval_cache.h"
+#include "hashtable.h"
+#include "pattern_eval.h"
+
+
+struct BenchOptions {
+    int depth;
+    int n_positions;
+    int plies;
+    int hash_mb;
+    int eval_cache_kb;
+    string weights_file;
+    int zobrist;
+    int eval;
+    int stress;
+    int threads;
+};
+
+const BenchOptions default_opts = {12, 20, 20, DEFAULT_HASH_MB, DEFAULT_EVAL_CACHE_KB, "weights.txt", 0, 0, 0, 4};
+
+
+void usage(char *argv[]) {
+    cerr << "Usage: " << argv[0] << " [-d DEPTH] [-n POSITIONS] [-p PLIES] [--hash MB] [--eval-cache KB] [-w WEIGHTS] [--zobrist] [--eval] [--stress [-j THREADS]]" << endl << endl;
+    cerr << "Runs fixed-depth midgame searches on positions reached by random play." << endl << endl;
+    cerr << "\t-d DEPTH: search each position to DEPTH (int).\t\t"
+         << "Default: " << default_opts.depth << endl;
+    cerr << "\t-n POSITIONS: number of positions to search (int).\t"
+         << "Default: " << default_opts.n_positions << endl;
+    cerr << "\t-p PLIES: random plies played to reach each position (int).\t"
+         << "Default: " << default_opts.plies << endl;
+    cerr << "\t--hash MB: hashtable size (int).\t\t\t"
+         << "Default: " << default_opts.hash_mb << endl;
+    cerr << "\t--eval-cache KB: eval cache size, 0 for none (int).\t"
+         << "Default: " << default_opts.eval_cache_kb << endl;
+    cerr << "\t-w WEIGHTS: load weights from WEIGHTS (str).\t\t"
+         << "Default: " << default_opts.weights_file << endl;
+    cerr << "\t--zobrist: time incremental against full-board hashing instead" << endl;
+    cerr << "\t--eval: check and time incremental against full evaluation instead" << endl;
+    cerr << "\t--stress: check the hashtable under concurrent gets and sets instead" << endl;
+    cerr << "\t-j THREADS: threads for --stress (int).\t\t\t"
+         << "Default: " << default_opts.threads << endl;
+}
+
+
+BenchOptions parse_opts(int argc, char *argv[]) {
+    BenchOptions ret = default_opts;
+
+    static struct option long_opts[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"hash", required_argument, NULL, 'H'},
+        {"eval-cache", required_argument, NULL, 'E'},
+        {"zobrist", no_argument, &ret.zobrist, 1},
+        {"eval", no_argument, &ret.eval, 1},
+        {"stress", no_argument, &ret.stress, 1},
+        {0, 0, 0, 0}
+    };
+
+    int optchar;
+    int optidx = 0;
+    while ((optchar = getopt_long(argc, argv, "hd:n:p:w:j:", long_opts, &optidx)) != -1) {
+        switch (optchar) {
+            case 0: break;
+            case 'd': ret.depth = std::stoi(optarg); break;
+            case 'n': ret.n_positions = std::stoi(optarg); break;
+            case 'p': ret.plies = std::stoi(optarg); break;
+            case 'H': ret.hash_mb = std::stoi(optarg); break;
+            case 'E': ret.eval_cache_kb = std::stoi(optarg); break;
+            case 'w': ret.weights_file = optarg; break;
+            case 'j': ret.threads = std::stoi(optarg); break;
+            case 'h':
+                usage(argv);
+                exit(0);
+            default:
+                usage(argv);
+                exit(1);
+        }
+    }
+
+    return ret;
+}
+
+
+/**
+ * Plays random legal moves from the starting position. Always gives the same
+ * positions for the same seed.
+ */
+vector<board::Board> random_positions(int n, int plies, unsigned seed) {
+    mt19937 rng(seed);
+    vector<board::Board> ret;
+
+    while ((int)ret.size() < n) {
+        board::Board b = board::starting_position();
+
+        int ply = 0;
+        bool passed = false;
+        while (ply < plies) {
+            uint64_t move_mask = board::get_moves(b);
+            if (move_mask == 0ULL) {
+                if (passed) break;
+                b = board::do_move(b, MOVE_PASS);
+                passed = true;
+                continue;
+            }
+            passed = false;
+
+            int pick = rng() % board::popcount(move_mask);
+            for (int i = 0; i < pick; i++) move_mask &= move_mask - 1;
+            b = board::do_move(b, __builtin_ctzll(move_mask));
+            ply++;
+        }
+
+        if (ply == plies) ret.push_back(b);
+    }
+
+    return ret;
+}
+
+
+/**
+ * Hashes every child of every position, once by hashing the whole board after
+ * do_move and once incrementally from the parent's HashedBoard.
+ */
+void zobrist_bench(const vector<board::Board> &positions) {
+    const int REPS = 20000;
+
+    long children = 0L;
+    uint64_t check_none = 0, check_full = 0, check_incr = 0;
+
+    // do_move alone, which both ways of hashing pay for.
+    timestamp start = get_time();
+    for (int r = 0; r < REPS; r++) {
+        for (auto b : positions) {
+            uint64_t move_mask = board::get_moves(b);
+            while (move_mask != 0ULL) {
+                int m = __builtin_ctzll(move_mask);
+                move_mask &= move_mask - 1;
+                check_none += board::do_move(b, m).own;
+            }
+        }
+    }
+    float time_none = get_time_since(start);
+
+    start = get_time();
+    for (int r = 0; r < REPS; r++) {
+        for (auto b : positions) {
+            uint64_t move_mask = board::get_moves(b);
+            while (move_mask != 0ULL) {
+                int m = __builtin_ctzll(move_mask);
+                move_mask &= move_mask - 1;
+                check_full += HashTable::hash(board::do_move(b, m));
+                children++;
+            }
+        }
+    }
+    float time_full = get_time_since(start);
+
+    start = get_time();
+    for (int r = 0; r < REPS; r++) {
+        for (auto b : positions) {
+            HashedBoard hb = hashed(b);
+            uint64_t move_mask = board::get_moves(b);
+            while (move_mask != 0ULL) {
+                int m = __builtin_ctzll(move_mask);
+                move_mask &= move_mask - 1;
+                check_incr += do_move(hb, m).key;
+            }
+        }
+    }
+    float time_incr = get_time_since(start);
+
+    fmt::print(stderr, "{:.3e} children, do_move {:.2f} ns/child (checksum {:x})\n",
+               (double)children, 1e9 * time_none / children, check_none & 0xff);
+    fmt::print(stderr, "full-board hash:  {:.2f} ns/child over do_move\n", 1e9 * (time_full - time_none) / children);
+    fmt::print(stderr, "incremental hash: {:.2f} ns/child over do_move (parent hash included)\n",
+               1e9 * (time_incr - time_none) / children);
+    if (check_full != check_incr) {
+        fmt::print(stderr, "MISMATCH between full-board and incremental hashes\n");
+        exit(1);
+    }
+}
+
+
+/**
+ * Plays n random games, checking at every move that the incrementally
+ * updated pattern indices match those of the board, and that they are the
+ * indices given by pattern_activations.
+ */
+void check_patterns(int n) {
+    mt19937 rng(2);
+    long checks = 0L;
+
+    for (int game = 0; game < n; game++) {
+        eval::PatternBoard pb = eval::patterned(board::starting_position());
+        bool passed = false;
+
+        while (true) {
+            eval::PatternBoard full = eval::patterned(pb.b);
+            int activations[eval::N_ALL_MASKS];
+            eval::pattern_activations(activations, pb.b);
+            checks++;
+            if (!equal(activations, activations + eval::N_ALL_MASKS, full.idx)
+                    || memcmp(full.idx, pb.idx, sizeof(pb.idx)) != 0
+                    || memcmp(full.idx_swapped, pb.idx_swapped, sizeof(pb.idx)) != 0
+                    || eval::score(pb) != eval::score(pb.b)) {
+                fmt::print(stderr, "MISMATCH between incremental, full evaluation and activations\n{}\n", board::to_str(pb.b));
+                exit(1);
+            }
+
+            uint64_t move_mask = board::get_moves(pb.b);
+            if (move_mask == 0ULL) {
+                if (passed) break;
+                pb = eval::do_move(pb, MOVE_PASS);
+                passed = true;
+                continue;
+            }
+            passed = false;
+
+            int pick = rng() % board::popcount(move_mask);
+            for (int i = 0; i < pick; i++) move_mask &= move_mask - 1;
+            pb = eval::do_move(pb, __builtin_ctzll(move_mask));
+        }
+    }
+
+    fmt::print(stderr, "{} positions in {} games match\n", checks, n);
+}
+
+/**
+ * Evaluates every child of every position: from scratch after do_move, from
+ * pattern indices updated from the parent's, and with all children scored
+ * together by score_batch.
+ */
+void eval_bench(const vector<board::Board> &positions) {
+    const int REPS = 20000;
+
+    // Check each child's score first, since the sums below can't tell a
+    // wrong score from two that cancel out, or from scores in the wrong slot.
+    for (auto b : positions) {
+        eval::PatternBoard pb = eval::patterned(b);
+        board::Board after[64];
+        int moves[64];
+        int scores[64];
+        int n = 0;
+        uint64_t move_mask = board::get_moves(b);
+        while (move_mask != 0ULL) {
+            moves[n] = __builtin_ctzll(move_mask);
+            move_mask &= move_mask - 1;
+            after[n] = board::do_move(b, moves[n]);
+            n++;
+        }
+        eval::score_batch(after, n, scores);
+
+        for (int i = 0; i < n; i++) {
+            int full = eval::score(after[i]);
+            int incr = eval::score(eval::do_move(pb, moves[i]));
+            if (incr != full || scores[i] != full) {
+                fmt::print(stderr, "MISMATCH at child {} of {}: full {}, incremental {}, batched {}\n{}\n",
+                           i, n, full, incr, scores[i], board::to_str(after[i]));
+                exit(1);
+            }
+        }
+    }
+
+    long children = 0L;
+    long check_full = 0L, check_incr = 0L;
+
+    timestamp start = get_time();
+    for (int r = 0; r < REPS; r++) {
+        for (auto b : positions) {
+            uint64_t move_mask = board::get_moves(b);
+            while (move_mask != 0ULL) {
+                int m = __builtin_ctzll(move_mask);
+                move_mask &= move_mask - 1;
+                check_full += eval::score(board::do_move(b, m));
+                children++;
+            }
+        }
+    }
+    float time_full = get_time_since(start);
+
+    start = get_time();
+    for (int r = 0; r < REPS; r++) {
+        for (auto b : positions) {
+            eval::PatternBoard pb = eval::patterned(b);
+            uint64_t move_mask = board::get_moves(b);
+            while (move_mask != 0ULL) {
+                int m = __builtin_ctzll(move_mask);
+                move_mask &= move_mask - 1;
+                check_incr += eval::score(eval::do_move(pb, m));
+            }
+        }
+    }
+    float time_incr = get_time_since(start);
+
+    long check_batch = 0L;
+    start = get_time();
+    for (int r = 0; r < REPS; r++) {
+        for (auto b : positions) {
+            board::Board after[64];
+            int scores[64];
+            int n = 0;
+            uint64_t move_mask = board::get_moves(b);
+            while (move_mask != 0ULL) {
+                int m = __builtin_ctzll(move_mask);
+                move_mask &= move_mask - 1;
+                after[n++] = board::do_move(b, m);
+            }
+            eval::score_batch(after, n, scores);
+            for (int i = 0; i < n; i++) check_batch += scores[i];
+        }
+    }
+    float time_batch = get_time_since(start);
+
+    fmt::print(stderr, "{:.3e} children\n", (double)children);
+    fmt::print(stderr, "full evaluation:        {:.2f} ns/child\n", 1e9 * time_full / children);
+    fmt::print(stderr, "incremental evaluation: {:.2f} ns/child (parent indices included)\n", 1e9 * time_incr / children);
+    fmt::print(stderr, "batched evaluation:     {:.2f} ns/child\n", 1e9 * time_batch / children);
+    if (check_full != check_incr || check_full != check_batch) {
+        fmt::print(stderr, "MISMATCH between full and incremental evaluation\n");
+        exit(1);
+    }
+}
+
+
+/**
+ * The node stored for key in stress_test, so that readers can tell whether an
+ * entry they got was written for the key they asked for.
+ */
+SearchNode stress_node(uint64_t key) {
+    return {
+        (int)((key >> 16) & 63),
+        (NodeType)((key >> 24) % 3),
+        (int)((key >> 32) & 0x3fff) - 0x2000,
+        (int)((key >> 48) & 63)
+    };
+}
+
+/**
+ * Has threads set and get a small set of keys that all fall in a few buckets,
+ * so entries are constantly overwritten by other threads, and counts the gets
+ * that return a node written for a different key.
+ */
+void stress_test(int n_threads, float seconds) {
+    const int N_KEYS = 256;
+    const int N_BUCKETS = 4;
+
+    HashTable ht(1);
+    ht.new_search();
+
+    mt19937_64 rng(1);
+    vector<uint64_t> keys(N_KEYS);
+    for (auto &key : keys) key = (rng() & ~0xffffULL) | (rng() % N_BUCKETS);
+
+    atomic<bool> stop(false);
+    vector<long> gets(n_threads), hits(n_threads), errors(n_threads);
+    vector<thread> threads;
+    for (int t = 0; t < n_threads; t++) {
+        threads.emplace_back([&, t]() {
+            mt19937 thread_rng(t);
+            while (!stop.load(memory_order_relaxed)) {
+                for (int i = 0; i < 1024; i++) {
+                    uint64_t key = keys[thread_rng() % N_KEYS];
+                    if (thread_rng() % 2) {
+                        ht.set(key, stress_node(key));
+                        continue;
+                    }
+
+                    SearchNode got;
+                    SearchNode want = stress_node(key);
+                    gets[t]++;
+                    if (!ht.get(key, got)) continue;
+                    hits[t]++;
+                    if (got.depth != want.depth || got.type != want.type
+                            || got.score != want.score || got.best_move != want.best_move) {
+                        errors[t]++;
+                    }
+                }
+            }
+        });
+    }
+
+    this_thread::sleep_for(chrono::duration<float>(seconds));
+    stop = true;
+    for (auto &t : threads) t.join();
+
+    long total_gets = 0L, total_hits = 0L, total_errors = 0L;
+    for (int t = 0; t < n_threads; t++) {
+        total_gets += gets[t];
+        total_hits += hits[t];
+        total_errors += errors[t];
+    }
+
+    fmt::print(stderr, "{} threads: {:.3e} gets, {:.3e} hits, {} inconsistent entries\n",
+               n_threads, (double)total_gets, (double)total_hits, total_errors);
+    if (total_errors != 0) exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    BenchOptions opts = parse_opts(argc, argv);
+
+    if (opts.zobrist) {
+        zobrist_bench(random_positions(opts.n_positions, opts.plies, 1));
+        return 0;
+    }
+
+    if (opts.eval) {
+        eval::load_weights(opts.weights_file);
+        check_patterns(1000);
+        eval_bench(random_positions(opts.n_positions, opts.plies, 1));
+        return 0;
+    }
+
+    if (opts.stress) {
+        stress_test(opts.threads, 5);
+        return 0;
+    }
+
+    eval::load_weights(opts.weights_file);
+
+    vector<board::Board> positions = random_positions(opts.n_positions, opts.plies, 1);
+    HashTable ht(opts.hash_mb);
+    unique_ptr<EvalCache> ec;
+    if (opts.eval_cache_kb > 0) ec = make_unique<EvalCache>(opts.eval_cache_kb);
+
+    fmt::print(stderr, "{} positions, depth {}, {} MB hashtable, {} KB eval cache\n",
+               positions.size(), opts.depth, ht.size_mb(), ec ? ec->size_kb() : 0);
+
+    long nodes = 0L;
+    long tt_probes = 0L;
+    long tt_hits = 0L;
+    long eval_probes = 0L;
+    long eval_hits = 0L;
+    timestamp start = get_time();
+
+    for (auto b : positions) {
+        ht.new_search();
+
+        // Iterative deepening as in the engine, but without aspiration windows
+        // so every position costs the same regardless of timing.
+        for (int depth = 2; depth <= opts.depth; depth++) {
+            SearchInfo si(&ht, ec.get(), 1e9, true);
+            ab_deep(b, -INT_MAX, INT_MAX, depth, false, si);
+
+            nodes += si.nodes;
+            tt_probes += si.tt_probes;
+            tt_hits += si.tt_hits;
+            eval_probes += si.eval_probes;
+            eval_hits += si.eval_hits;
+        }
+    }
+
+    float time_spent = get_time_since(start);
+
+    fmt::print(stderr, "{:.4e} nodes in {:.3f}s @ {:.3e} node/s\n", (double)nodes, time_spent, nodes / time_spent);
+    fmt::print(stderr, "hashtable {:.2f}% hits of {:.3e} probes\n", 100. * tt_hits / max(tt_probes, 1L), (double)tt_probes);
+    if (ec) {
+        fmt::print(stderr, "eval cache {:.2f}% hits of {:.3e} probes\n",
+                   100. * eval_hits / max(eval_probes, 1L), (double)eval_probes);
+    }
+
+    return 0;
+}
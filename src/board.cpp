@@ -1,6 +1,8 @@
 #include "board.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <immintrin.h>
 
 
 using namespace std;
@@ -175,7 +177,7 @@ uint64_t soWeOne(uint64_t gen) {
  *
  * Returns a long representing squares that can be played in.
  */
-uint64_t get_moves(Board b) {
+uint64_t get_moves_scalar(Board b) {
     uint64_t empty, tmp, moves;
 
     moves = 0L;
@@ -209,6 +211,55 @@ uint64_t get_moves(Board b) {
 }
 
 
+#ifdef __AVX2__
+
+/*
+ * The same fills as get_moves_scalar, four directions at a time: each 64-bit
+ * lane shifts by one of 1, 8, 9 and 7, left in one pass and right in the
+ * other. Rather than masking the file a shift comes from, opponent pieces on
+ * the edge files are dropped from the propagator in the directions that
+ * cross files. A ray can't be flanked past an edge, so this finds the same
+ * moves, and it lets every lane share one mask for both shift directions.
+ */
+uint64_t get_moves(Board b) {
+    const __m256i shift = _mm256_setr_epi64x(1, 8, 9, 7);
+    const __m256i shift2 = _mm256_add_epi64(shift, shift);
+    const __m256i pro_mask = _mm256_setr_epi64x(
+        0x7e7e7e7e7e7e7e7e, 0xffffffffffffffff, 0x7e7e7e7e7e7e7e7e, 0x7e7e7e7e7e7e7e7e);
+
+    __m256i own = _mm256_set1_epi64x(b.own);
+    __m256i pro = _mm256_and_si256(_mm256_set1_epi64x(b.opp), pro_mask);
+
+    // Opponent runs of one, then two more, then two more: up to the six
+    // squares a ray can cross.
+    __m256i left = _mm256_and_si256(pro, _mm256_sllv_epi64(own, shift));
+    __m256i right = _mm256_and_si256(pro, _mm256_srlv_epi64(own, shift));
+    left = _mm256_or_si256(left, _mm256_and_si256(pro, _mm256_sllv_epi64(left, shift)));
+    right = _mm256_or_si256(right, _mm256_and_si256(pro, _mm256_srlv_epi64(right, shift)));
+
+    __m256i pro_left = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift));
+    __m256i pro_right = _mm256_srlv_epi64(pro_left, shift);
+    left = _mm256_or_si256(left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(left, shift2)));
+    right = _mm256_or_si256(right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(right, shift2)));
+    left = _mm256_or_si256(left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(left, shift2)));
+    right = _mm256_or_si256(right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(right, shift2)));
+
+    __m256i moves = _mm256_or_si256(_mm256_sllv_epi64(left, shift), _mm256_srlv_epi64(right, shift));
+    __m128i moves2 = _mm_or_si128(_mm256_castsi256_si128(moves), _mm256_extracti128_si256(moves, 1));
+    moves2 = _mm_or_si128(moves2, _mm_unpackhi_epi64(moves2, moves2));
+
+    return _mm_cvtsi128_si64(moves2) & ~(b.own | b.opp);
+}
+
+#else
+
+uint64_t get_moves(Board b) {
+    return get_moves_scalar(b);
+}
+
+#endif
+
+
 /**
  * Get frontier pieces:
  * Gives the number of pieces of color c that are adjacent to empty squares.
@@ -234,51 +285,126 @@ int get_frontier(Board b) {
 }
 
 
-void get_stable(Board b, int *n_own, int *n_opp) {
-    const uint64_t top    = 0xff00000000000000;
-    const uint64_t bottom = 0x00000000000000ff;
-    const uint64_t left   = 0x0101010101010101;
-    const uint64_t right  = 0x8080808080808080;
-
-    uint64_t pcs, vert, horiz, diag1, diag2, stable_own, stable_opp;
-
-    pcs = b.own | b.opp;
-
-    vert  = nortOccl(bottom & pcs, pcs) & soutOccl(top & pcs, pcs);
-    horiz = eastOccl(left & pcs, pcs) & westOccl(right & pcs, pcs);
-    diag1 = noEaOccl((bottom | left) & pcs, pcs) & soWeOccl((top | right) & pcs, pcs);
-    diag2 = noWeOccl((bottom | right) & pcs, pcs) & soEaOccl((top | left) & pcs, pcs);
-
-    stable_own = (0x8100000000000081 | (vert & horiz & diag1 & diag2)) & b.own;
-    stable_opp = (0x8100000000000081 | (vert & horiz & diag1 & diag2)) & b.opp;
-
-    /* Expand the stable areas. */
-    for (int ii = 0; ii < 8; ++ii) {
-        stable_own |= b.own & (
-            (nortOne(stable_own) | soutOne(stable_own) | vert) &
-            (eastOne(stable_own) | westOne(stable_own) | horiz) &
-            (noEaOne(stable_own) | soWeOne(stable_own) | diag1) &
-            (noWeOne(stable_own) | soEaOne(stable_own) | diag2)
-        );
-        stable_opp |= b.opp & (
-            (nortOne(stable_opp) | soutOne(stable_opp) | vert) &
-            (eastOne(stable_opp) | westOne(stable_opp) | horiz) &
-            (noEaOne(stable_opp) | soWeOne(stable_opp) | diag1) &
-            (noWeOne(stable_opp) | soEaOne(stable_opp) | diag2)
-        );
+/*
+ * Stable pieces:
+ * A piece on an edge can only be flipped along that edge, so edge stability is
+ * looked up in a table of every edge, indexed in base 3. An edge's stable
+ * pieces are those that no sequence of moves on the edge by either side can
+ * flip, taking any empty square as playable. Other pieces are stable if every
+ * line through them is full, or they have a stable own neighbour along it.
+ */
+const uint64_t EDGE_A = 0x0101010101010101;
+const uint64_t EDGE_H = 0x8080808080808080;
+const uint64_t EDGE_1 = 0x00000000000000ff;
+const uint64_t EDGE_8 = 0xff00000000000000;
+const uint64_t INTERIOR = 0x007e7e7e7e7e7e00;
+
+uint16_t edge_ternary[256];
+uint8_t edge_stable[6561];
+
+
+// Pieces of a flipped by b playing at x on an edge.
+int edge_flips(int b, int a, int x) {
+    int flips = 0;
+    for (int dir = -1; dir <= 1; dir += 2) {
+        int run = 0;
+        int j = x + dir;
+        while (j >= 0 && j < 8 && (a & (1 << j))) {
+            run |= 1 << j;
+            j += dir;
+        }
+        if (j >= 0 && j < 8 && (b & (1 << j))) flips |= run;
+    }
+    return flips;
+}
+
+
+bool init_edge_stable() {
+    for (int x = 0; x < 256; x++) {
+        edge_ternary[x] = 0;
+        for (int i = 7; i >= 0; i--) edge_ternary[x] = edge_ternary[x] * 3 + ((x >> i) & 1);
     }
 
-    *n_own = popcount(stable_own);
-    *n_opp = popcount(stable_opp);
-    /* return popcount(stable_own) - popcount(stable_opp); */
+    // Edges with fewer empties first, since moves only lead to those.
+    for (int n_empty = 0; n_empty <= 8; n_empty++) {
+        for (int own = 0; own < 256; own++) {
+            for (int opp = 0; opp < 256; opp++) {
+                int empty = ~(own | opp) & 0xff;
+                if ((own & opp) || __builtin_popcount(empty) != n_empty) continue;
+
+                int stable = own | opp;
+                for (int x = 0; x < 8; x++) {
+                    if (!(empty & (1 << x))) continue;
+
+                    int flips = edge_flips(own, opp, x);
+                    stable &= ~flips & edge_stable[edge_ternary[own | (1 << x) | flips] + 2 * edge_ternary[opp ^ flips]];
+                    flips = edge_flips(opp, own, x);
+                    stable &= ~flips & edge_stable[edge_ternary[own ^ flips] + 2 * edge_ternary[opp | (1 << x) | flips]];
+                }
+                edge_stable[edge_ternary[own] + 2 * edge_ternary[opp]] = stable;
+            }
+        }
+    }
+
+    return true;
+}
+
+const bool edge_stable_ready = init_edge_stable();
+
+
+uint64_t edge_stable_along(Board b, uint64_t edge) {
+    int own = _pext_u64(b.own, edge);
+    int opp = _pext_u64(b.opp, edge);
+    return _pdep_u64(edge_stable[edge_ternary[own] + 2 * edge_ternary[opp]], edge);
 }
 
 
 /*
- * Make-move: Makes a move for color c in position pos, and updates the board's
- * hash. Give -1 as pos for pass.
+ * Gives the stable pieces of the side to move.
  */
-Board do_move(Board b, int pos) {
+uint64_t get_stable_discs(Board b) {
+    uint64_t pcs = b.own | b.opp;
+
+    uint64_t stable = edge_stable_along(b, EDGE_1) | edge_stable_along(b, EDGE_8) |
+                      edge_stable_along(b, EDGE_A) | edge_stable_along(b, EDGE_H);
+    stable &= b.own;
+
+    // Squares whose line in each direction is full.
+    uint64_t vert  = nortOccl(EDGE_1 & pcs, pcs) & soutOccl(EDGE_8 & pcs, pcs);
+    uint64_t horiz = eastOccl(EDGE_A & pcs, pcs) & westOccl(EDGE_H & pcs, pcs);
+    uint64_t diag1 = noEaOccl((EDGE_1 | EDGE_A) & pcs, pcs) & soWeOccl((EDGE_8 | EDGE_H) & pcs, pcs);
+    uint64_t diag2 = noWeOccl((EDGE_1 | EDGE_H) & pcs, pcs) & soEaOccl((EDGE_8 | EDGE_A) & pcs, pcs);
+
+    uint64_t candidates = b.own & INTERIOR;
+    stable |= candidates & vert & horiz & diag1 & diag2;
+
+    // Grow from the stable pieces until nothing changes. Only interior
+    // squares are added, so shifts wrapping onto the far file don't matter.
+    uint64_t old_stable;
+    do {
+        old_stable = stable;
+        stable |= candidates &
+            ((stable << 8) | (stable >> 8) | vert) &
+            ((stable << 1) | (stable >> 1) | horiz) &
+            ((stable << 9) | (stable >> 9) | diag1) &
+            ((stable << 7) | (stable >> 7) | diag2);
+    } while (stable != old_stable);
+
+    return stable;
+}
+
+
+void get_stable(Board b, int *n_own, int *n_opp) {
+    *n_own = popcount(get_stable_discs(b));
+    *n_opp = popcount(get_stable_discs(Board{b.opp, b.own}));
+}
+
+
+/*
+ * Flips: Gives the pieces that playing at pos would flip, or 0 if the move
+ * isn't legal (pos must be empty).
+ */
+uint64_t get_flips_scalar(Board b, int pos) {
     /*
     * Gen is a one-hot long representing the added
     * piece. Filling from gen along opponent pieces and &-ing with rays in the
@@ -289,11 +415,6 @@ Board do_move(Board b, int pos) {
 
     uint64_t gen, diff;
 
-    /* -1 for pass. */
-    if (pos == -1) {
-        return Board{b.opp, b.own};
-    }
-
     gen = 1L << pos;
 
     diff = 0L;
@@ -306,10 +427,275 @@ Board do_move(Board b, int pos) {
     diff |= noWeOccl(gen, b.opp) & soEaOccl(b.own, b.opp);
     diff |= soWeOccl(gen, b.opp) & noEaOccl(b.own, b.opp);
 
-    return Board{b.opp ^ diff, (b.own ^ diff) | gen};
+    return diff;
+}
+
+
+/*
+ * Make-move: Makes a move for color c in position pos, and updates the board's
+ * hash. Give -1 as pos for pass.
+ */
+Board do_move_scalar(Board b, int pos) {
+    /* -1 for pass. */
+    if (pos == -1) {
+        return Board{b.opp, b.own};
+    }
+
+    uint64_t diff = get_flips_scalar(b, pos);
+    return Board{b.opp ^ diff, (b.own ^ diff) | (1ULL << pos)};
+}
+
+
+#ifdef __AVX2__
+
+/*
+ * Flips four directions at a time, with the same lanes and propagator masks
+ * as get_moves. Each lane fills from the new piece along the opponent's
+ * pieces, and keeps the run only if an own piece ends it.
+ */
+uint64_t get_flips(Board b, int pos) {
+    const __m256i shift = _mm256_setr_epi64x(1, 8, 9, 7);
+    const __m256i shift2 = _mm256_add_epi64(shift, shift);
+    const __m256i pro_mask = _mm256_setr_epi64x(
+        0x7e7e7e7e7e7e7e7e, 0xffffffffffffffff, 0x7e7e7e7e7e7e7e7e, 0x7e7e7e7e7e7e7e7e);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i gen4 = _mm256_set1_epi64x(1ULL << pos);
+    __m256i own = _mm256_set1_epi64x(b.own);
+    __m256i pro = _mm256_and_si256(_mm256_set1_epi64x(b.opp), pro_mask);
+
+    __m256i left = _mm256_and_si256(pro, _mm256_sllv_epi64(gen4, shift));
+    __m256i right = _mm256_and_si256(pro, _mm256_srlv_epi64(gen4, shift));
+    left = _mm256_or_si256(left, _mm256_and_si256(pro, _mm256_sllv_epi64(left, shift)));
+    right = _mm256_or_si256(right, _mm256_and_si256(pro, _mm256_srlv_epi64(right, shift)));
+
+    __m256i pro_left = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift));
+    __m256i pro_right = _mm256_srlv_epi64(pro_left, shift);
+    left = _mm256_or_si256(left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(left, shift2)));
+    right = _mm256_or_si256(right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(right, shift2)));
+    left = _mm256_or_si256(left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(left, shift2)));
+    right = _mm256_or_si256(right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(right, shift2)));
+
+    // Drop runs with no own piece just past them.
+    __m256i outflank_left = _mm256_and_si256(own, _mm256_sllv_epi64(left, shift));
+    __m256i outflank_right = _mm256_and_si256(own, _mm256_srlv_epi64(right, shift));
+    left = _mm256_andnot_si256(_mm256_cmpeq_epi64(outflank_left, zero), left);
+    right = _mm256_andnot_si256(_mm256_cmpeq_epi64(outflank_right, zero), right);
+
+    __m256i flips = _mm256_or_si256(left, right);
+    __m128i flips2 = _mm_or_si128(_mm256_castsi256_si128(flips), _mm256_extracti128_si256(flips, 1));
+    flips2 = _mm_or_si128(flips2, _mm_unpackhi_epi64(flips2, flips2));
+    return _mm_cvtsi128_si64(flips2);
+}
+
+#else
+
+uint64_t get_flips(Board b, int pos) {
+    return get_flips_scalar(b, pos);
+}
+
+#endif
+
+
+Board do_move(Board b, int pos) {
+    if (pos == -1) {
+        return Board{b.opp, b.own};
+    }
+
+    uint64_t diff = get_flips(b, pos);
+    return Board{b.opp ^ diff, (b.own ^ diff) | (1ULL << pos)};
 }
 
 
+
+/*
+ * Child generation:
+ * A move's flips in one direction are its fill along opponent pieces, &-ed
+ * with the fill from own pieces in the opposite direction, as in do_move. The
+ * fills from own pieces are the same for every move, and are also the fills
+ * get_moves makes, so they are done once for the node.
+ *
+ * Writes the board after each move to out and, if mobility_out isn't null,
+ * the number of replies to it to mobility_out. Returns the moves, which are
+ * in the same order as the children from the lowest square up.
+ */
+uint64_t expand_children_scalar(Board b, Board *out, int *mobility_out) {
+    uint64_t moves = get_moves_scalar(b);
+
+    // Each ray from a move ends at an own piece in behind_*.
+    uint64_t behind_sout = nortOccl(b.own, b.opp);
+    uint64_t behind_nort = soutOccl(b.own, b.opp);
+    uint64_t behind_east = westOccl(b.own, b.opp);
+    uint64_t behind_west = eastOccl(b.own, b.opp);
+    uint64_t behind_noEa = soWeOccl(b.own, b.opp);
+    uint64_t behind_soEa = noWeOccl(b.own, b.opp);
+    uint64_t behind_noWe = soEaOccl(b.own, b.opp);
+    uint64_t behind_soWe = noEaOccl(b.own, b.opp);
+
+    int n = 0;
+    for (uint64_t mask = moves; mask != 0ULL; mask &= mask - 1) {
+        uint64_t gen = mask & -mask;
+
+        uint64_t diff = 0L;
+        diff |= soutOccl(gen, b.opp) & behind_sout;
+        diff |= nortOccl(gen, b.opp) & behind_nort;
+        diff |= eastOccl(gen, b.opp) & behind_east;
+        diff |= westOccl(gen, b.opp) & behind_west;
+        diff |= noEaOccl(gen, b.opp) & behind_noEa;
+        diff |= soEaOccl(gen, b.opp) & behind_soEa;
+        diff |= noWeOccl(gen, b.opp) & behind_noWe;
+        diff |= soWeOccl(gen, b.opp) & behind_soWe;
+
+        out[n] = Board{b.opp ^ diff, (b.own ^ diff) | gen};
+        if (mobility_out) mobility_out[n] = popcount(get_moves_scalar(out[n]));
+        n++;
+    }
+
+    return moves;
+}
+
+
+#ifdef __AVX2__
+
+/*
+ * Fills of four boards at once, one per lane, in the direction of a shift by
+ * S. These shift every lane by the same amount, unlike the fills in get_moves.
+ */
+template <int S>
+__m256i fill_left_x4(__m256i gen, __m256i pro) {
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_slli_epi64(gen, S)));
+    pro = _mm256_and_si256(pro, _mm256_slli_epi64(pro, S));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_slli_epi64(gen, 2 * S)));
+    pro = _mm256_and_si256(pro, _mm256_slli_epi64(pro, 2 * S));
+    return _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_slli_epi64(gen, 4 * S)));
+}
+
+template <int S>
+__m256i fill_right_x4(__m256i gen, __m256i pro) {
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srli_epi64(gen, S)));
+    pro = _mm256_and_si256(pro, _mm256_srli_epi64(pro, S));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srli_epi64(gen, 2 * S)));
+    pro = _mm256_and_si256(pro, _mm256_srli_epi64(pro, 2 * S));
+    return _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srli_epi64(gen, 4 * S)));
+}
+
+// Flips in the directions of shifts by S, given the fills from own pieces
+// the other way.
+template <int S>
+__m256i flips_x4(__m256i gen, __m256i pro, __m256i behind_left, __m256i behind_right) {
+    return _mm256_or_si256(_mm256_and_si256(fill_left_x4<S>(gen, pro), behind_left),
+                           _mm256_and_si256(fill_right_x4<S>(gen, pro), behind_right));
+}
+
+// Moves in the directions of shifts by S, for the boards in own and opp.
+template <int S>
+__m256i moves_x4(__m256i own, __m256i opp, __m256i pro) {
+    return _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(fill_left_x4<S>(own, pro), opp), S),
+                           _mm256_srli_epi64(_mm256_and_si256(fill_right_x4<S>(own, pro), opp), S));
+}
+
+/*
+ * Makes the moves four at a time, one per lane. The fills from own pieces use
+ * the four-direction lanes of get_moves, and are then spread into one vector
+ * per direction for the moves. Pieces on the edge files are dropped from the
+ * propagators that cross files, as in get_moves.
+ */
+uint64_t expand_children(Board b, Board *out, int *mobility_out) {
+    const __m256i shift = _mm256_setr_epi64x(1, 8, 9, 7);
+    const __m256i shift2 = _mm256_add_epi64(shift, shift);
+    const __m256i shift4 = _mm256_add_epi64(shift2, shift2);
+    const uint64_t inner = 0x7e7e7e7e7e7e7e7e;
+    const __m256i pro_mask = _mm256_setr_epi64x(inner, 0xffffffffffffffff, inner, inner);
+    const __m256i inner4 = _mm256_set1_epi64x(inner);
+
+    __m256i own = _mm256_set1_epi64x(b.own);
+    __m256i opp = _mm256_set1_epi64x(b.opp);
+    __m256i pro = _mm256_and_si256(opp, pro_mask);
+
+    // Own pieces and the opponent runs from them in each direction.
+    __m256i pro_left = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift));
+    __m256i pro_right = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, shift));
+    __m256i own_left = _mm256_or_si256(own, _mm256_and_si256(pro, _mm256_sllv_epi64(own, shift)));
+    __m256i own_right = _mm256_or_si256(own, _mm256_and_si256(pro, _mm256_srlv_epi64(own, shift)));
+    own_left = _mm256_or_si256(own_left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(own_left, shift2)));
+    own_right = _mm256_or_si256(own_right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(own_right, shift2)));
+    pro_left = _mm256_and_si256(pro_left, _mm256_sllv_epi64(pro_left, shift2));
+    pro_right = _mm256_and_si256(pro_right, _mm256_srlv_epi64(pro_right, shift2));
+    own_left = _mm256_or_si256(own_left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(own_left, shift4)));
+    own_right = _mm256_or_si256(own_right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(own_right, shift4)));
+
+    __m256i move_vec = _mm256_or_si256(_mm256_sllv_epi64(_mm256_and_si256(own_left, pro), shift),
+                                       _mm256_srlv_epi64(_mm256_and_si256(own_right, pro), shift));
+    __m128i move_vec2 = _mm_or_si128(_mm256_castsi256_si128(move_vec), _mm256_extracti128_si256(move_vec, 1));
+    move_vec2 = _mm_or_si128(move_vec2, _mm_unpackhi_epi64(move_vec2, move_vec2));
+    uint64_t moves_mask = _mm_cvtsi128_si64(move_vec2) & ~(b.own | b.opp);
+
+    // A ray going left ends in the fill from own pieces going right.
+    __m256i behind_left1 = _mm256_permute4x64_epi64(own_right, 0x00);
+    __m256i behind_left8 = _mm256_permute4x64_epi64(own_right, 0x55);
+    __m256i behind_left9 = _mm256_permute4x64_epi64(own_right, 0xaa);
+    __m256i behind_left7 = _mm256_permute4x64_epi64(own_right, 0xff);
+    __m256i behind_right1 = _mm256_permute4x64_epi64(own_left, 0x00);
+    __m256i behind_right8 = _mm256_permute4x64_epi64(own_left, 0x55);
+    __m256i behind_right9 = _mm256_permute4x64_epi64(own_left, 0xaa);
+    __m256i behind_right7 = _mm256_permute4x64_epi64(own_left, 0xff);
+    __m256i pro_inner = _mm256_and_si256(opp, inner4);
+
+    int n = 0;
+    uint64_t mask = moves_mask;
+    while (mask != 0ULL) {
+        // Lanes past the last move get no piece, and are left out below.
+        int n_lanes = min(popcount(mask), 4);
+        uint64_t gen0 = mask & -mask;
+        mask ^= gen0;
+        uint64_t gen1 = mask & -mask;
+        mask ^= gen1;
+        uint64_t gen2 = mask & -mask;
+        mask ^= gen2;
+        uint64_t gen3 = mask & -mask;
+        mask ^= gen3;
+        __m256i gen = _mm256_setr_epi64x(gen0, gen1, gen2, gen3);
+
+        __m256i diff = flips_x4<1>(gen, pro_inner, behind_left1, behind_right1);
+        diff = _mm256_or_si256(diff, flips_x4<8>(gen, opp, behind_left8, behind_right8));
+        diff = _mm256_or_si256(diff, flips_x4<9>(gen, pro_inner, behind_left9, behind_right9));
+        diff = _mm256_or_si256(diff, flips_x4<7>(gen, pro_inner, behind_left7, behind_right7));
+
+        alignas(32) uint64_t child_own[4], child_opp[4];
+        __m256i after_own = _mm256_xor_si256(opp, diff);
+        __m256i after_opp = _mm256_or_si256(_mm256_xor_si256(own, diff), gen);
+        _mm256_store_si256((__m256i *) child_own, after_own);
+        _mm256_store_si256((__m256i *) child_opp, after_opp);
+
+        if (mobility_out) {
+            __m256i after_pro = _mm256_and_si256(after_opp, inner4);
+            __m256i reply = moves_x4<1>(after_own, after_opp, after_pro);
+            reply = _mm256_or_si256(reply, moves_x4<8>(after_own, after_opp, after_opp));
+            reply = _mm256_or_si256(reply, moves_x4<9>(after_own, after_opp, after_pro));
+            reply = _mm256_or_si256(reply, moves_x4<7>(after_own, after_opp, after_pro));
+            reply = _mm256_andnot_si256(_mm256_or_si256(after_own, after_opp), reply);
+
+            alignas(32) uint64_t replies[4];
+            _mm256_store_si256((__m256i *) replies, reply);
+            for (int i = 0; i < n_lanes; i++) mobility_out[n + i] = popcount(replies[i]);
+        }
+
+        for (int i = 0; i < n_lanes; i++) out[n + i] = Board{child_own[i], child_opp[i]};
+        n += n_lanes;
+    }
+
+    return moves_mask;
+}
+
+#else
+
+uint64_t expand_children(Board b, Board *out, int *mobility_out) {
+    return expand_children_scalar(b, out, mobility_out);
+}
+
+#endif
+
+
 Board add_piece(Board b, int pos, bool c) {
     if (c == PIECE_OWN) {
         b.own |= (1L << pos);
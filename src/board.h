@@ -23,10 +23,26 @@ Board starting_position();
 Board from_str(std::string position);
 
 uint64_t get_moves(Board b);
+// Portable version of get_moves, which is vectorized on AVX2 builds. Kept
+// for checking it against.
+uint64_t get_moves_scalar(Board b);
 int get_frontier(Board b);
 void get_stable(Board b, int *n_own, int *n_opp);
+// Pieces of the side to move that can't be flipped for the rest of the game.
+uint64_t get_stable_discs(Board b);
 
 Board do_move(Board b, int pos);
+// Portable version of do_move, which is vectorized on AVX2 builds.
+Board do_move_scalar(Board b, int pos);
+// Pieces flipped by playing at the empty square pos, or 0 if it isn't legal.
+uint64_t get_flips(Board b, int pos);
+uint64_t get_flips_scalar(Board b, int pos);
+
+// Makes every move, writing the children to out and, unless mobility_out is
+// null, the number of replies to each. Returns the moves; the children are in
+// order of square, and out and mobility_out need room for all of them.
+uint64_t expand_children(Board b, Board *out, int *mobility_out);
+uint64_t expand_children_scalar(Board b, Board *out, int *mobility_out);
 Board add_piece(Board b, int pos, bool c);
 
 string to_grid(Board b, bool color);
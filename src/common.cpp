@@ -34,8 +34,12 @@ float win_prob(int score) {
 }
 
 
-float get_time_since(clock_t start) {
-    return (float)(clock() - start) / CLOCKS_PER_SEC;
+timestamp get_time() {
+    return chrono::steady_clock::now();
+}
+
+float get_time_since(timestamp start) {
+    return chrono::duration<float>(chrono::steady_clock::now() - start).count();
 }
 
 
@@ -65,3 +69,53 @@ void ProgressBar::step() {
         last_progress = p;
     }
 }
+
+
+HelperPool::HelperPool(int n_helpers) {
+    for (int i = 0; i < n_helpers; i++) {
+        threads.emplace_back(&HelperPool::loop, this, i);
+    }
+}
+
+HelperPool::~HelperPool() {
+    {
+        lock_guard<mutex> lk(m);
+        quit = true;
+    }
+    work_cv.notify_all();
+
+    for (auto &t : threads) t.join();
+}
+
+void HelperPool::start(function<void(int)> new_task) {
+    {
+        lock_guard<mutex> lk(m);
+        task = move(new_task);
+        running = threads.size();
+        generation++;
+    }
+    work_cv.notify_all();
+}
+
+void HelperPool::wait() {
+    unique_lock<mutex> lk(m);
+    done_cv.wait(lk, [&]() { return running == 0; });
+}
+
+void HelperPool::loop(int id) {
+    long seen = 0L;
+    while (true) {
+        {
+            unique_lock<mutex> lk(m);
+            work_cv.wait(lk, [&]() { return quit || generation != seen; });
+            if (quit) return;
+            seen = generation;
+        }
+
+        // task isn't replaced until every helper has finished it.
+        task(id);
+
+        lock_guard<mutex> lk(m);
+        if (--running == 0) done_cv.notify_all();
+    }
+}
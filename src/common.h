@@ -2,7 +2,11 @@
 
 #include <string>
 #include <vector>
-#include <time.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include "board.h"
 
@@ -25,7 +29,12 @@ int notation_to_move(const string &input);
 
 float win_prob(int score);
 
-float get_time_since(clock_t start);
+// Wall-clock timestamps. CPU time (clock()) would run faster than real time
+// once the search is spread over several threads.
+typedef chrono::steady_clock::time_point timestamp;
+
+timestamp get_time();
+float get_time_since(timestamp start);
 
 
 template <typename T> int sgn(T val) {
@@ -79,3 +88,29 @@ private:
     long unsigned current_val;
     long unsigned last_progress;
 };
+
+
+// Threads kept for as long as the pool, so that work handed out again and
+// again (search iterations, training batches) doesn't start threads of its
+// own. start hands every helper the same task, called with the helper's
+// index, and wait returns once they have all finished it.
+class HelperPool {
+public:
+    HelperPool(int n_helpers);
+    ~HelperPool();
+    HelperPool(const HelperPool &) = delete;
+    HelperPool &operator=(const HelperPool &) = delete;
+    void start(function<void(int)> task);
+    void wait();
+private:
+    void loop(int id);
+
+    vector<thread> threads;
+    mutex m;
+    condition_variable work_cv;
+    condition_variable done_cv;
+    function<void(int)> task;
+    long generation = 0L;   // counts tasks handed out
+    int running = 0;        // helpers still on the current task
+    bool quit = false;
+};
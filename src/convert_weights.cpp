@@ -0,0 +1,16 @@
+#include <iostream>
+
+#include "common.h"
+#include "pattern_eval.h"
+
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        cerr << "usage: convert_weights weights_in weights_out" << endl;
+        cerr << "Converts weights (text or binary) to the binary format." << endl;
+        exit(1);
+    }
+
+    eval::load_weights(argv[1]);
+    eval::save_weights_binary(argv[2]);
+}
@@ -7,6 +7,7 @@
 #include "book.h"
 
 #include <iostream>
+#include <thread>
 #include <fmt/core.h>
 #include <climits>
 #include <time.h>
@@ -59,6 +60,11 @@ SearchResult CPU::next_move(board::Board b, int ms_left) {
         if (!try_endgame) fmt::print(stderr, "saving {:.1f}s for endgame at {} empties\n", eg_time, eg_empties);
     }
 
+    tt_probes = 0L;
+    tt_hits = 0L;
+    eval_probes = 0L;
+    eval_hits = 0L;
+
     SearchResult result = search(b, empties, time_budget, try_endgame);
 
     total_nodes += result.nodes;
@@ -66,6 +72,12 @@ SearchResult CPU::next_move(board::Board b, int ms_left) {
 
     if (print_search_info) {
         double nps = (double)result.nodes / result.time_spent;
+        if (tt_probes > 0) {
+            fmt::print(stderr, "hashtable {:.1f}% hits of {:.2e} probes\n", 100. * tt_hits / tt_probes, (double)tt_probes);
+        }
+        if (eval_probes > 0) {
+            fmt::print(stderr, "eval cache {:.1f}% hits of {:.2e} probes\n", 100. * eval_hits / eval_probes, (double)eval_probes);
+        }
         fmt::print(stderr, "{:.2e} nodes in {:.3f}s @ {:.2e} node/s\n\n", (double)result.nodes, result.time_spent, nps);
     }
 
@@ -75,7 +87,7 @@ SearchResult CPU::next_move(board::Board b, int ms_left) {
 
 SearchResult CPU::search(board::Board b, int empties, double time_budget, bool try_endgame) {
     long nodes = 0L;
-    clock_t start = clock();
+    timestamp start = get_time();
 
     // Opening book
     int book_move = book::search(b);
@@ -110,11 +122,14 @@ SearchResult CPU::search(board::Board b, int empties, double time_budget, bool t
     }
 
     // Midgame search
+    ht.new_search();
     SearchNode mid_result = midgame_search(b, empties, time_budget - get_time_since(start), &nodes, true); 
 
     // If search returns a guaranteed win/loss, check with no forward pruning.
+    // Bounds in the table depend on forward pruning, so start a new generation.
     if (mid_result.score == INT_MAX || mid_result.score == -INT_MAX) {
         if (print_search_info) fmt::print(stderr, "re-search without forward pruning\n");
+        ht.new_search();
         mid_result = midgame_search(b, empties, time_budget, &nodes, false);
     }
 
@@ -123,8 +138,6 @@ SearchResult CPU::search(board::Board b, int empties, double time_budget, bool t
 
 
 SearchNode CPU::midgame_search(board::Board b, int empties, double time_limit, long *nodes, bool forward_prune) {
-    HashTable ht;
-
     int alpha = -INT_MAX;
     int beta = INT_MAX;
 
@@ -144,12 +157,51 @@ SearchNode CPU::midgame_search(board::Board b, int empties, double time_limit, l
                 depth, win_prob(alpha), win_prob(beta));
         }
 
-        SearchInfo si(&ht, time_limit - time_spent, forward_prune);
+        // Lazy SMP: helper threads search the same root in the same window,
+        // every other one a ply deeper, and feed the shared hashtable. They
+        // are stopped as soon as the main thread finishes its search.
+        atomic<bool> stop(false);
+        vector<SearchInfo> helper_si;
+        vector<SearchNode> helper_results(n_threads - 1);
+        for (int i = 1; i < n_threads; i++) {
+            helper_si.emplace_back(&ht, eval_cache(i), time_limit - time_spent, forward_prune, &stop);
+        }
+        helpers.start([&](int i) {
+            int helper_depth = min(depth + (i + 1) % 2, empties);
+            helper_results[i] = ab_deep(b, alpha, beta, helper_depth, false, helper_si[i]);
+        });
+
+        SearchInfo si(&ht, eval_cache(0), time_limit - time_spent, forward_prune);
         SearchNode new_result = ab_deep(b, alpha, beta, depth, false, si);
 
+        stop = true;
+        helpers.wait();
+
         last_time = get_time_since(si.start);
         time_spent += last_time;
         (*nodes) += si.nodes;
+        tt_probes += si.tt_probes;
+        tt_hits += si.tt_hits;
+        eval_probes += si.eval_probes;
+        eval_hits += si.eval_hits;
+
+        // Combine results: a helper that finished a deeper search inside the
+        // window before being stopped beats the main thread's result.
+        long iter_nodes = si.nodes;
+        for (int i = 0; i < n_threads - 1; i++) {
+            (*nodes) += helper_si[i].nodes;
+            iter_nodes += helper_si[i].nodes;
+            tt_probes += helper_si[i].tt_probes;
+            tt_hits += helper_si[i].tt_hits;
+            eval_probes += helper_si[i].eval_probes;
+            eval_hits += helper_si[i].eval_hits;
+
+            SearchNode h = helper_results[i];
+            if (h.type == NodeType::PV && h.score > alpha && h.score < beta &&
+                (new_result.type == NodeType::TIMEOUT || h.depth > new_result.depth)) {
+                new_result = h;
+            }
+        }
 
         if (new_result.type == TIMEOUT) {
             if (print_search_info) {
@@ -192,7 +244,8 @@ SearchNode CPU::midgame_search(board::Board b, int empties, double time_limit, l
                         move_to_notation(result.best_move), win_prob(result.score), last_time);
             }
 
-            branch_factor = pow((float)si.nodes, 1 / (float)depth);
+            branch_factor = pow((float)iter_nodes / n_threads, 1 / (float)depth);
+            depth = max(depth, result.depth);
 
             // Set aspiration window around result for next search.
             alpha = result.score - ASP_WINDOW;
@@ -213,7 +266,9 @@ SearchNode CPU::midgame_search(board::Board b, int empties, double time_limit, l
 
 
 SearchNode CPU::endgame_search(board::Board b, int empties, double time_limit, long *nodes, bool wld) {
-    clock_t start = clock();
+    timestamp start = get_time();
+
+    endgame::new_search();
 
     SearchNode result;
     if (wld) {
@@ -226,6 +281,9 @@ SearchNode CPU::endgame_search(board::Board b, int empties, double time_limit, l
 
     double time_spent = get_time_since(start);
 
+    vector<long> helper_nodes = endgame::take_helper_nodes();
+    for (auto hn : helper_nodes) (*nodes) += hn;
+
     if (print_search_info) {
         if (result.type == NodeType::TIMEOUT) {
             fmt::print(stderr, "TIMEOUT  {:.3f}s\n", time_spent);
@@ -238,6 +296,12 @@ SearchNode CPU::endgame_search(board::Board b, int empties, double time_limit, l
                 fmt::print(stderr, "{} {:+3}   {:.3f}s\n", move_to_notation(result.best_move), result.score, time_spent);
             }
         }
+
+        if (helper_nodes.size() > 0) {
+            fmt::print(stderr, "               \thelper nodes:");
+            for (auto hn : helper_nodes) fmt::print(stderr, " {:.2e}", (double)hn);
+            fmt::print(stderr, "\n");
+        }
     }
 
     return result;
@@ -258,4 +322,13 @@ double CPU::est_eg_time(int empties) {
 double CPU::avg_nps() {
     if (total_time == 0 || total_nodes == 0) return 1e7; // arbitrary estimate for when there's no data
     return (double)total_nodes / total_time;
-}
\ No newline at end of file
+}
+
+
+/**
+ * Gives the eval cache of a search thread, or nullptr if caching is off.
+ */
+EvalCache *CPU::eval_cache(int thread) {
+    if (eval_caches.empty()) return nullptr;
+    return &eval_caches[thread];
+}
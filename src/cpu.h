@@ -1,6 +1,10 @@
 #pragma once
 
+#include <vector>
+
 #include "common.h"
+#include "eval_cache.h"
+#include "hashtable.h"
 
 struct SearchResult {
     SearchNode node;
@@ -11,11 +15,16 @@ struct SearchResult {
 
 class CPU {
 public:
-    CPU(int s, double t, int e, bool p):
+    CPU(int s, double t, int e, bool p, int j = 1, size_t hash_mb = DEFAULT_HASH_MB,
+        size_t eval_cache_kb = DEFAULT_EVAL_CACHE_KB):
         max_depth(s),
         max_time(t),
         endgame_depth(e),
-        print_search_info(p) {};
+        print_search_info(p),
+        n_threads(j),
+        ht(hash_mb, j),
+        eval_caches(eval_cache_kb > 0 ? j : 0, EvalCache(eval_cache_kb)),
+        helpers(j - 1) {};
     SearchResult next_move(board::Board b, int ms_left);
 private:
     SearchResult search(board::Board b, int empties, double time_budget, bool try_endgame);
@@ -24,12 +33,30 @@ private:
     double est_eg_time(int empties);
     int est_eg_empties(double time);
     double avg_nps();
+    EvalCache *eval_cache(int thread);
 
     const int max_depth;
     const double max_time;
     const int endgame_depth;
     const bool print_search_info;
+    const int n_threads;
 
     long total_nodes = 0L;
     double total_time = 0;
+
+    // Hashtable probes and hits in midgame searches for the current move.
+    long tt_probes = 0L;
+    long tt_hits = 0L;
+    long eval_probes = 0L;
+    long eval_hits = 0L;
+
+    // Kept for the whole game so each search can reuse the previous ones.
+    HashTable ht;
+
+    // One per search thread, also kept for the whole game. Empty if disabled.
+    std::vector<EvalCache> eval_caches;
+
+    // Declared last so the helpers are stopped before what they search with
+    // is freed.
+    HelperPool helpers;
 };
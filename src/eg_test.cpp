@@ -2,8 +2,8 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <time.h>
 #include <climits>
+#include <getopt.h>
 
 #include "board.h"
 #include "endgame.h"
@@ -13,6 +13,8 @@
 const bool DISPLAY = false;
 const unsigned PROGRESS_DOTS = 50;
 
+const int DEFAULT_SPLIT_EMPTIES = 14;
+
 
 
 void runtests(const string &filename, int empties_wanted) {
@@ -44,10 +46,12 @@ void runtests(const string &filename, int empties_wanted) {
 
 
     int incorrect = 0;
+    int inexact = 0;
 
     float max_time = 0;
     float total_time = 0;
     long total_nodes = 0;
+    vector<long> thread_nodes;
 
     int last_progress = 0;
     int n_tests = 0;
@@ -62,6 +66,9 @@ void runtests(const string &filename, int empties_wanted) {
         total_nodes += stats.nodes;
         if (stats.time_spent > max_time) max_time = stats.time_spent;
 
+        thread_nodes.resize(stats.thread_nodes.size(), 0L);
+        for (unsigned i = 0; i < stats.thread_nodes.size(); i++) thread_nodes[i] += stats.thread_nodes[i];
+
         /* cout << stats.time_spent << "\n"; */
 
         if (sgn(score) != sgn(pos.score)) {
@@ -70,6 +77,7 @@ void runtests(const string &filename, int empties_wanted) {
 
             incorrect++;
         }
+        if (score != pos.score) inexact++;
 
         n_tests++;
 
@@ -95,21 +103,64 @@ void runtests(const string &filename, int empties_wanted) {
 
     cerr << "Avg nodes: " << (double)total_nodes / (double)positions.size() << endl;
 
+    if (thread_nodes.size() > 1) {
+        for (unsigned i = 0; i < thread_nodes.size(); i++) {
+            cerr << "Thread " << i << ": " << (float)thread_nodes[i] << " nodes\n";
+        }
+    }
+
     cerr << "Total incorrect: " << incorrect << "\n";
+    cerr << "Inexact scores: " << inexact << "\n";
 }
 
 
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        cerr << "usage: eg_tests empties positions_file ..." << "\n";
+    int threads = 1;
+    int split_empties = DEFAULT_SPLIT_EMPTIES;
+    int hash_mb = DEFAULT_EG_HASH_MB;
+    int hash_empties = DEFAULT_EG_HASH_EMPTIES;
+    int stability_empties = DEFAULT_STABILITY_EMPTIES;
+
+    int optchar;
+    while ((optchar = getopt(argc, argv, "j:s:m:t:c:")) != -1) {
+        switch (optchar) {
+            case 'j':
+                threads = max(1, stoi(optarg));
+                break;
+            case 's':
+                split_empties = stoi(optarg);
+                break;
+            case 'm':
+                hash_mb = stoi(optarg);
+                break;
+            case 't':
+                hash_empties = stoi(optarg);
+                break;
+            case 'c':
+                stability_empties = stoi(optarg);
+                break;
+            default:
+                cerr << "usage: eg_tests [-j THREADS] [-s SPLIT_EMPTIES] [-m HASH_MB] [-t HASH_EMPTIES] [-c STABILITY_EMPTIES] empties positions_file ..." << "\n";
+                exit(1);
+        }
+    }
+
+    if (argc - optind < 2) {
+        cerr << "usage: eg_tests [-j THREADS] [-s SPLIT_EMPTIES] [-m HASH_MB] [-t HASH_EMPTIES] [-c STABILITY_EMPTIES] empties positions_file ..." << "\n";
         exit(1);
     }
 
-    int empties = stoi(argv[1]);
+    int empties = stoi(argv[optind]);
 
-    for (int i = 2; i < argc; i++) {
+    endgame::set_hashtable(hash_mb, hash_empties);
+    endgame::set_stability_cutoffs(stability_empties);
+    endgame::start_threads(threads - 1, split_empties);
+
+    for (int i = optind + 1; i < argc; i++) {
         cerr << "Running " << argv[i] << "\n";
         runtests(argv[i], empties);
         cerr << "\n";
     }
+
+    endgame::stop_threads();
 }
@@ -1,8 +1,14 @@
 #include "endgame.h"
 
-#include <time.h>
 #include <iostream>
 #include <climits>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <memory>
 
 #include "pattern_eval.h"
 
@@ -12,22 +18,257 @@ namespace endgame {
 
 const int DEEP_CUTOFF = 10;
 const int MED_CUTOFF = 7;
+// eg_medium hands nodes with MED_CUTOFF empties or fewer to eg_shallow after
+// making a move, so eg_shallow has at most one empty less.
+const int SHALLOW_MAX_EMPTIES = MED_CUTOFF - 1;
+static_assert(SHALLOW_MAX_EMPTIES == 6, "eg_shallow dispatches 2 to 6 empties");
+
+// Shallow nodes with at least this many empties try odd quadrants first.
+const int PARITY_MIN_EMPTIES = 5;
 
 const int KM_WEIGHT_DEEP = 3;
 const int KM_WEIGHT_MED = 1;
 
 
+/* ====== HASHTABLE ====== */
+
+unique_ptr<HashTable> table;
+int table_min_empties = INT_MAX;
+
+
+void set_hashtable(size_t mb, int min_empties) {
+    table.reset(mb > 0 ? new HashTable(mb) : nullptr);
+    // Only eg_deep nodes use the table.
+    table_min_empties = max(min_empties, DEEP_CUTOFF + 1);
+}
+
+void new_search() {
+    if (table) table->new_search();
+}
+
+
+/* ====== STABILITY ====== */
+
+int stability_min_empties = DEFAULT_STABILITY_EMPTIES;
+
+
+void set_stability_cutoffs(int min_empties) {
+    stability_min_empties = min_empties;
+}
+
+/**
+ * Upper bound on the final score from the opponent's stable discs, or 64 when
+ * even taking every other disc couldn't bring the score down to alpha.
+ */
+int stability_bound(board::Board b, int alpha) {
+    if (alpha < 64 - 2 * board::popcount(b.opp)) return 64;
+    return 64 - 2 * board::popcount(board::get_stable_discs(board::Board{b.opp, b.own}));
+}
+
+
+/**
+ * Stores the result of an eg_deep node and gives it back.
+ */
+SearchNode store(uint64_t key, int empties, SearchNode result) {
+    if (key != 0ULL && result.type != NodeType::TIMEOUT) {
+        table->set(key, {empties, result.type, result.score, result.best_move});
+    }
+    return result;
+}
+
+
+/* ====== PARALLEL SEARCH ====== */
+
+struct SplitPoint {
+    ScoredMove *moves;
+    int n_moves;
+    int beta;
+    int empties;
+    timestamp start;
+    float time_limit;
+    SplitPoint *parent;
+
+    atomic<int> next;       // index of the next move to hand out
+    atomic<int> alpha;      // best score so far
+    atomic<int> workers;    // helpers currently searching a move here
+    atomic<bool> abort;     // set on a beta cutoff or timeout
+
+    mutex m;                // guards the fields below
+    condition_variable done;    // signalled when workers drops to 0
+    int best_move;
+    bool cutoff;
+    bool timeout;
+};
+
+vector<thread> helpers;
+// Each helper's node count on its own cache line, so that counting nodes
+// doesn't bounce one line between the helpers.
+struct alignas(64) NodeCount {
+    long n = 0L;
+};
+
+vector<NodeCount> helper_nodes;
+int split_min_empties = INT_MAX;
+
+mutex pool_mutex;
+condition_variable pool_cv;
+vector<SplitPoint *> active_splits;
+bool pool_quit = false;
+
+
+/**
+ * True if the search below sp is no longer needed, because some split point
+ * above it has been cut off or timed out.
+ */
+bool aborted(SplitPoint *sp) {
+    for (; sp != nullptr; sp = sp->parent) {
+        if (sp->abort.load(memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+
+/**
+ * Searches moves of the split point until none are left. Called by the owner
+ * of the split point as well as by helpers.
+ */
+void search_split(SplitPoint *sp, long *n) {
+    int i;
+    while ((i = sp->next++) < sp->n_moves) {
+        if (sp->abort) return;
+
+        int alpha = sp->alpha;
+        int score;
+
+        if (sp->empties <= DEEP_CUTOFF) {
+            score = -eg_medium(sp->moves[i].after, -sp->beta, -alpha, sp->empties - 1, false, n);
+        } else {
+            SearchNode result = eg_deep(sp->moves[i].after, -sp->beta, -alpha, sp->empties - 1, false, n,
+                                        sp->start, sp->time_limit, sp);
+            if (result.type == NodeType::TIMEOUT) {
+                if (!aborted(sp)) {
+                    lock_guard<mutex> lk(sp->m);
+                    sp->timeout = true;
+                    sp->abort = true;
+                }
+                return;
+            }
+
+            score = -result.score;
+        }
+
+        lock_guard<mutex> lk(sp->m);
+        if (score >= sp->beta) {
+            if (!sp->cutoff) sp->best_move = sp->moves[i].move;
+            sp->cutoff = true;
+            sp->abort = true;
+            return;
+        }
+        if (score > sp->alpha) {
+            sp->alpha = score;
+            sp->best_move = sp->moves[i].move;
+        }
+    }
+}
+
+
+void helper_loop(int id) {
+    while (true) {
+        SplitPoint *sp = nullptr;
+        {
+            unique_lock<mutex> lk(pool_mutex);
+            pool_cv.wait(lk, [&]() {
+                if (pool_quit) return true;
+                for (auto s : active_splits) {
+                    if (s->next < s->n_moves && !s->abort) {
+                        sp = s;
+                        return true;
+                    }
+                }
+                return false;
+            });
+            if (pool_quit) return;
+
+            // Registered under pool_mutex so the owner can't retire the split
+            // point between us finding it and joining it.
+            sp->workers++;
+        }
+
+        search_split(sp, &helper_nodes[id].n);
+
+        // Notified under the lock, since the owner may free sp as soon as it
+        // sees no workers left.
+        lock_guard<mutex> lk(sp->m);
+        if (--sp->workers == 0) sp->done.notify_all();
+    }
+}
+
+
+void start_threads(int n_helpers, int split_empties) {
+    stop_threads();
+
+    // Helpers wait on pool_cv, which can't be destroyed while they do, so an
+    // exit() anywhere after this stops them first.
+    static bool stop_at_exit = false;
+    if (!stop_at_exit) {
+        atexit(stop_threads);
+        stop_at_exit = true;
+    }
+
+    // Only eg_deep nodes can be split.
+    split_min_empties = max(split_empties, DEEP_CUTOFF + 1);
+    pool_quit = false;
+    helper_nodes.assign(max(n_helpers, 0), NodeCount());
+    for (int i = 0; i < n_helpers; i++) {
+        helpers.emplace_back(helper_loop, i);
+    }
+}
+
+void stop_threads() {
+    {
+        lock_guard<mutex> lk(pool_mutex);
+        pool_quit = true;
+    }
+    pool_cv.notify_all();
+
+    for (auto &t : helpers) t.join();
+    helpers.clear();
+    helper_nodes.clear();
+}
+
+int n_helper_threads() {
+    return helpers.size();
+}
+
+vector<long> take_helper_nodes() {
+    vector<long> ret;
+    for (auto &count : helper_nodes) {
+        ret.push_back(count.n);
+        count.n = 0L;
+    }
+    return ret;
+}
+
+
 int solve(board::Board b, EndgameStats &stats, bool display) {
-    clock_t start = clock();
+    timestamp start = get_time();
     long nodes = 0L;
 
     int empties = 64 - board::popcount(b.own | b.opp);
+    new_search();
     SearchNode result = eg_deep(b, -INT_MAX, INT_MAX, empties, false, &nodes, start, 100.);
 
-    clock_t end = clock();
-    float time_spent = (float)(end - start) / CLOCKS_PER_SEC;
+    float time_spent = get_time_since(start);
 
-    stats.nodes += nodes;
+    vector<long> thread_nodes = take_helper_nodes();
+    thread_nodes.insert(thread_nodes.begin(), nodes);
+
+    stats.thread_nodes.resize(thread_nodes.size(), 0L);
+    for (unsigned i = 0; i < thread_nodes.size(); i++) {
+        stats.nodes += thread_nodes[i];
+        stats.thread_nodes[i] += thread_nodes[i];
+        if (i > 0) nodes += thread_nodes[i];
+    }
     stats.time_spent += time_spent;
 
     if (display) {
@@ -39,14 +280,73 @@ int solve(board::Board b, EndgameStats &stats, bool display) {
 }
 
 
-SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed, long *n, clock_t start, float time_limit) {
+/**
+ * Searches moves[1..] of an eg_deep node together with any idle helpers.
+ * moves[0] has already been searched, giving best_score and best_move.
+ */
+SearchNode eg_split(board::Board b, ScoredMove *moves, int n_moves, int best_score, int alpha, int beta, int best_move,
+                    int empties, long *n, timestamp start, float time_limit, SplitPoint *parent) {
+    std::sort(moves + 1, moves + n_moves);
+
+    SplitPoint sp;
+    sp.moves = moves;
+    sp.n_moves = n_moves;
+    sp.beta = beta;
+    sp.empties = empties;
+    sp.start = start;
+    sp.time_limit = time_limit;
+    sp.parent = parent;
+    sp.next = 1;
+    sp.alpha = best_score;
+    sp.workers = 0;
+    sp.abort = false;
+    sp.best_move = best_move;
+    sp.cutoff = false;
+    sp.timeout = false;
+
+    {
+        lock_guard<mutex> lk(pool_mutex);
+        active_splits.push_back(&sp);
+    }
+    pool_cv.notify_all();
+
+    search_split(&sp, n);
+
+    // No more moves to hand out: retire the split point and wait for helpers
+    // still searching here.
+    {
+        lock_guard<mutex> lk(pool_mutex);
+        active_splits.erase(std::find(active_splits.begin(), active_splits.end(), &sp));
+    }
+    {
+        unique_lock<mutex> lk(sp.m);
+        sp.done.wait(lk, [&]() { return sp.workers == 0; });
+    }
+
+    if (sp.cutoff) return {DEPTH_100, NodeType::HIGH, beta, sp.best_move};
+    if (sp.timeout || aborted(parent)) return {DEPTH_100, NodeType::TIMEOUT, 0, -1};
+
+    if (sp.alpha > alpha) {
+        return {DEPTH_100, NodeType::PV, sp.alpha, sp.best_move};
+    } else {
+        return {DEPTH_100, NodeType::LOW, alpha, sp.best_move};
+    }
+}
+
+
+SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed, long *n, timestamp start, float time_limit, SplitPoint *sp) {
     (*n)++;
 
-    // Check for timeout.
-    if (get_time_since(start) >= time_limit) {
+    // Check for timeout, or for a split point above us being cut off.
+    if (get_time_since(start) >= time_limit || aborted(sp)) {
         return {empties, NodeType::TIMEOUT, 0, -1};
     }
 
+    if (empties >= stability_min_empties) {
+        int max_score = stability_bound(b, alpha);
+        if (max_score <= alpha) return {DEPTH_100, NodeType::LOW, max_score, MOVE_LOSE};
+    }
+
     uint64_t move_mask = board::get_moves(b);
 
     if (move_mask == 0ULL) {
@@ -54,7 +354,7 @@ SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed
             int score = board::popcount(b.own) - board::popcount(b.opp);
             return {DEPTH_100, NodeType::PV, score, -1};
         } else {
-            SearchNode result = eg_deep(board::Board{b.opp, b.own}, -beta, -alpha, empties, true, n, start, time_limit);
+            SearchNode result = eg_deep(board::Board{b.opp, b.own}, -beta, -alpha, empties, true, n, start, time_limit, sp);
             if (result.type == NodeType::TIMEOUT) { // propagate timeouts back up
                 return {DEPTH_100, NodeType::TIMEOUT, 0, -1};
             }
@@ -63,28 +363,65 @@ SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed
         }
     }
 
+    // Check hashtable for a cutoff, or failing that a move to try first.
+    // Key 0 means the node isn't stored.
+    uint64_t key = 0ULL;
+    int table_move = MOVE_NULL;
+    if (table && empties >= table_min_empties) {
+        key = HashTable::hash(b);
+
+        SearchNode table_entry;
+        if (table->get(key, table_entry, true)) {
+            if (table_entry.type == NodeType::PV)
+                return {DEPTH_100, NodeType::PV, table_entry.score, table_entry.best_move};
+            if (table_entry.type == NodeType::HIGH && table_entry.score >= beta)
+                return {DEPTH_100, NodeType::HIGH, table_entry.score, table_entry.best_move};
+            if (table_entry.type == NodeType::LOW && table_entry.score <= alpha)
+                return {DEPTH_100, NodeType::LOW, table_entry.score, MOVE_LOSE};
+
+            table_move = table_entry.best_move;
+        }
+    }
+
     // Get all moves, boards, and opponent mobilities in arrays for sorting
     ScoredMove moves[32];
+    board::Board afters[32];
+    int mobilities[32];
+    int evals[32];
     int n_moves = 0;
+    board::expand_children(b, afters, mobilities);
     while (move_mask != 0ULL) {
         int m = __builtin_ctzll(move_mask);
         move_mask &= move_mask - 1;
 
-        board::Board after = board::do_move(b, m);
-        int opp_moves = board::popcount(board::get_moves(after));
+        moves[n_moves] = ScoredMove{m, 0, afters[n_moves]};
+        n_moves++;
+    }
+
+    eval::score_batch(afters, n_moves, evals);
+    for (int i = 0; i < n_moves; i++) {
+        int m = moves[i].move;
+        int opp_moves = mobilities[i];
 
         if (m == 0 || m == 7 || m == 56 || m == 63) opp_moves -= KM_WEIGHT_DEEP;
-        opp_moves += eval::score(after) / 40;
+        opp_moves += evals[i] / 40;
+        if (m == table_move) opp_moves = -INT_MAX;
 
-        moves[n_moves] = ScoredMove{m, opp_moves, after};
-        n_moves++;
+        moves[i].score = opp_moves;
     }
 
     int best_move = MOVE_LOSE;
     int best_score = alpha;
     for (auto i = 0; i < n_moves; i++) {
-        // Traverse ahead to find best move index
-        int best = INT_MAX;
+        // Once the first move is searched, share the rest with helper threads.
+        if (i == 1 && empties >= split_min_empties && !helpers.empty()) {
+            return store(key, empties,
+                eg_split(b, moves, n_moves, best_score, alpha, beta, best_move, empties, n, start, time_limit, sp));
+        }
+
+        // Traverse ahead to find best move index. A move already in place,
+        // like the table move, stays unless a later one is better.
+        int best = moves[i].score;
         int best_idx = i;
         for (auto j = i + 1; j < n_moves; j++) {
             int score = moves[j].score;
@@ -107,7 +444,7 @@ SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed
         if (empties <= DEEP_CUTOFF) {
             score = -eg_medium(moves[i].after, -beta, -best_score, empties - 1, false, n);
         } else {
-            SearchNode result = eg_deep(moves[i].after, -beta, -best_score, empties - 1, false, n, start, time_limit);
+            SearchNode result = eg_deep(moves[i].after, -beta, -best_score, empties - 1, false, n, start, time_limit, sp);
             if (result.type == NodeType::TIMEOUT) { // propagate timeouts back up
                 return {DEPTH_100, NodeType::TIMEOUT, 0, -1};
             }
@@ -116,7 +453,7 @@ SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed
         }
 
         if (score >= beta) {
-            return {DEPTH_100, NodeType::HIGH, beta, moves[i].move};
+            return store(key, empties, {DEPTH_100, NodeType::HIGH, beta, moves[i].move});
         }
         if (score > best_score) {
             best_score = score;
@@ -125,15 +462,19 @@ SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed
     }
 
     if (best_score > alpha) {
-        return {DEPTH_100, NodeType::PV, best_score, best_move};
+        return store(key, empties, {DEPTH_100, NodeType::PV, best_score, best_move});
     } else {
-        return {DEPTH_100, NodeType::LOW, alpha, best_move};
+        return store(key, empties, {DEPTH_100, NodeType::LOW, alpha, best_move});
     }
 }
 
 int eg_medium(board::Board b, int alpha, int beta, int empties, bool passed, long *n) {
     (*n)++;
 
+    if (empties >= stability_min_empties) {
+        if (stability_bound(b, alpha) <= alpha) return alpha;
+    }
+
     uint64_t move_mask = board::get_moves(b);
 
     if (move_mask == 0ULL) {
@@ -143,23 +484,25 @@ int eg_medium(board::Board b, int alpha, int beta, int empties, bool passed, lon
 
     // Get all moves, boards, and opponent mobilities in arrays for sorting
     ScoredMove moves[32];
+    board::Board afters[32];
+    int mobilities[32];
     int n_moves = 0;
+    board::expand_children(b, afters, mobilities);
     while (move_mask != 0ULL) {
         int m = __builtin_ctzll(move_mask);
         move_mask &= move_mask - 1;
 
-        board::Board after = board::do_move(b, m);
-        int opp_moves = board::popcount(board::get_moves(after));
-
+        int opp_moves = mobilities[n_moves];
         if (m == 0 || m == 7 || m == 56 || m == 63) opp_moves -= KM_WEIGHT_MED;
 
-        moves[n_moves] = ScoredMove{m, opp_moves, after};
+        moves[n_moves] = ScoredMove{m, opp_moves, afters[n_moves]};
         n_moves++;
     }
 
     for (auto i = 0; i < n_moves; i++) {
-        // Traverse ahead to find best move index
-        int best = INT_MAX;
+        // Traverse ahead to find best move index. The move in place stays
+        // unless a later one is better.
+        int best = moves[i].score;
         int best_idx = i;
         for (auto j = i + 1; j < n_moves; j++) {
             int score = moves[j].score;
@@ -193,31 +536,122 @@ int eg_medium(board::Board b, int alpha, int beta, int empties, bool passed, lon
 }
 
 
-int eg_shallow(board::Board b, int alpha, int beta, int empties, bool passed, long *n) {
+/* ====== LAST EMPTIES ====== */
+
+/*
+ * The last few empties are solved without move generation: each empty square
+ * is tried directly, and is a move if it flips something. Passes are handled
+ * in the same routines.
+ */
+
+board::Board after_flips(board::Board b, int sq, uint64_t flips) {
+    return board::Board{b.opp ^ flips, (b.own ^ flips) | (1ULL << sq)};
+}
+
+
+/**
+ * Score with one empty square left. Only the number of flips is needed, not
+ * the board after the move.
+ */
+int eg_last1(board::Board b, int sq, long *n) {
     (*n)++;
 
-    if (empties == 0) {
-        return board::popcount(b.own) - board::popcount(b.opp);
-    }
+    // 63 pieces on the board.
+    int own = board::popcount(b.own);
 
-    uint64_t move_mask = board::get_moves(b);
+    int flips = board::popcount(board::get_flips(b, sq));
+    if (flips != 0) return 2 * (own + flips) - 62;
 
-    if (move_mask == 0ULL) {
-        if (passed) return board::popcount(b.own) - board::popcount(b.opp);
-        return -eg_shallow(board::Board{b.opp, b.own}, -beta, -alpha, empties, true, n);
+    flips = board::popcount(board::get_flips(board::Board{b.opp, b.own}, sq));
+    if (flips != 0) return 2 * (own - flips) - 64;
+
+    return 2 * own - 63;
+}
+
+
+// Parity bit of the quadrant of each square.
+int quadrant_bit(int sq) {
+    return 1 << (((sq >> 5) & 1) * 2 + ((sq >> 2) & 1));
+}
+
+
+/**
+ * Solves the last N empties, from 2 up to SHALLOW_MAX_EMPTIES, at the squares
+ * given.
+ * parity has a bit set for each quadrant with an odd number of empties. Moves
+ * in those quadrants are tried first: the side that moves there can often
+ * take the quadrant's last square too.
+ */
+template <int N>
+int eg_last(board::Board b, int alpha, int beta, const int *squares, int parity, bool passed, long *n) {
+    (*n)++;
+
+    // With fewer empties, ordering costs more than it saves, and one pass
+    // takes every move.
+    constexpr bool ordered = N >= PARITY_MIN_EMPTIES;
+
+    if (N >= stability_min_empties && stability_bound(b, alpha) <= alpha) return alpha;
+
+    uint64_t moves = board::get_moves(b);
+    for (int odd = ordered; odd >= 0; odd--) {
+        for (int i = 0; i < N; i++) {
+            int sq = squares[i];
+            if (!(moves & (1ULL << sq))) continue;
+            if (ordered && ((parity & quadrant_bit(sq)) != 0) != odd) continue;
+
+            board::Board after = after_flips(b, sq, board::get_flips(b, sq));
+            int score;
+            if constexpr (N == 2) {
+                score = -eg_last1(after, squares[1 - i], n);
+            } else {
+                int rest[N - 1];
+                for (int j = 0, k = 0; j < N; j++) {
+                    if (j != i) rest[k++] = squares[j];
+                }
+                score = -eg_last<N - 1>(after, -beta, -alpha, rest, parity ^ quadrant_bit(sq), false, n);
+            }
+
+            if (score >= beta) return beta;
+            if (score > alpha) alpha = score;
+        }
     }
 
-    while (move_mask != 0ULL) {
-        int m = __builtin_ctzll(move_mask);
-        move_mask &= move_mask - 1;
+    if (moves != 0ULL) return alpha;
+    if (passed) return board::popcount(b.own) - board::popcount(b.opp);
+    return -eg_last<N>(board::Board{b.opp, b.own}, -beta, -alpha, squares, parity, true, n);
+}
 
-        int score = -eg_shallow(board::do_move(b, m), -beta, -alpha, empties - 1, false, n);
 
-        if (score >= beta) return beta;
-        if (score > alpha) alpha = score;
+/**
+ * Search for the last SHALLOW_MAX_EMPTIES empties. The empty squares and the
+ * quadrant parity are worked out once here, and kept up to date by the
+ * solvers above, which only try moves on those squares.
+ */
+int eg_shallow(board::Board b, int alpha, int beta, int empties, bool passed, long *n) {
+    if (empties >= 2) {
+        int squares[SHALLOW_MAX_EMPTIES];
+        int parity = 0;
+        uint64_t empty = ~(b.own | b.opp);
+        for (int i = 0; i < empties; i++) {
+            squares[i] = __builtin_ctzll(empty);
+            parity ^= quadrant_bit(squares[i]);
+            empty &= empty - 1;
+        }
+
+        switch (empties) {
+            case 6: return eg_last<6>(b, alpha, beta, squares, parity, passed, n);
+            case 5: return eg_last<5>(b, alpha, beta, squares, parity, passed, n);
+            case 4: return eg_last<4>(b, alpha, beta, squares, parity, passed, n);
+            case 3: return eg_last<3>(b, alpha, beta, squares, parity, passed, n);
+            default: return eg_last<2>(b, alpha, beta, squares, parity, passed, n);
+        }
+    }
+    if (empties == 1) {
+        return eg_last1(b, __builtin_ctzll(~(b.own | b.opp)), n);
     }
 
-    return alpha;
+    (*n)++;
+    return board::popcount(b.own) - board::popcount(b.opp);
 }
 
 
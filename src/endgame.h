@@ -1,18 +1,47 @@
 #include "board.h"
 #include "common.h"
+#include "hashtable.h"
 
 namespace endgame {
 
 const int MOVE_LOSE = 255;
 
+#define DEFAULT_EG_HASH_MB 64
+#define DEFAULT_EG_HASH_EMPTIES 11
+#define DEFAULT_STABILITY_EMPTIES 4
+
 struct EndgameStats {
     long nodes = 0L;
     float time_spent = 0.;
+    vector<long> thread_nodes;  // index 0 is the calling thread, then helpers
 };
 
+// Node of eg_deep whose remaining moves are shared with helper threads.
+struct SplitPoint;
+
+// Helper threads for eg_deep. Once the first move of a node with at least
+// split_empties empties has been searched, idle helpers take the remaining
+// moves (young brothers wait).
+void start_threads(int n_helpers, int split_empties);
+void stop_threads();
+int n_helper_threads();
+// Node counts of each helper since the last call, which resets them.
+vector<long> take_helper_nodes();
+
+// Hashtable for eg_deep nodes with at least min_empties empties. Exact scores
+// don't depend on the search, so entries are kept across solves. A size of 0
+// turns the table off.
+void set_hashtable(size_t mb, int min_empties);
+// Called before each solve so that older entries are replaced first.
+void new_search();
+
+// Nodes with at least min_empties empties fail low without searching when the
+// opponent's stable discs already hold the score to alpha or below.
+void set_stability_cutoffs(int min_empties);
+
 int solve(board::Board b, EndgameStats &stats, bool display);
 
-SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed, long *n, clock_t start, float time_limit);
+SearchNode eg_deep(board::Board b, int alpha, int beta, int empties, bool passed, long *n, timestamp start, float time_limit, SplitPoint *sp = nullptr);
 int eg_medium(board::Board b, int alpha, int beta, int empties, bool passed, long *n);
 int eg_shallow(board::Board b, int alpha, int beta, int empties, bool passed, long *n);
 
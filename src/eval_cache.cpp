@@ -0,0 +1,30 @@
+#include "eval_cache.h"
+
+
+/**
+ * Makes a cache of at most kb kilobytes, rounded down to a power of two
+ * entries (at least two).
+ */
+EvalCache::EvalCache(size_t kb) {
+    size_t n_entries = 2;
+    while (n_entries * 2 * sizeof(EvalCacheEntry) <= kb << 10) n_entries *= 2;
+
+    entries.resize(n_entries);
+    index_mask = n_entries - 1;
+    clear();
+}
+
+
+/**
+ * Empties the cache, for when the weights change.
+ */
+void EvalCache::clear() {
+    // Lookups at index i only ever match keys ending in i, so an entry whose
+    // key ends in anything else is empty.
+    for (size_t i = 0; i < entries.size(); i++) entries[i] = {i ^ 1, 0};
+}
+
+
+size_t EvalCache::size_kb() const {
+    return (entries.size() * sizeof(EvalCacheEntry)) >> 10;
+}
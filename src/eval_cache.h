@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+
+#include "board.h"
+
+
+// Off by default: the full-board evaluations it covers are under 1% of
+// midgame nodes, so the probes cost about what the hits save.
+#define DEFAULT_EVAL_CACHE_KB 0
+
+
+// Direct-mapped cache of static evaluations. ProbCut and static eval pruning
+// evaluate many of the boards that the searches after them evaluate again.
+//
+// Each search thread has its own cache, so there is no locking. Positions
+// are verified by their full 64-bit key, as in the hashtable.
+struct EvalCacheEntry {
+    uint64_t key;
+    int32_t score;
+};
+
+class EvalCache {
+public:
+    EvalCache(size_t kb);
+
+    bool get(uint64_t key, int &score) const {
+        const EvalCacheEntry &entry = entries[key & index_mask];
+        if (entry.key != key) return false;
+        score = entry.score;
+        return true;
+    }
+
+    void set(uint64_t key, int score) {
+        entries[key & index_mask] = {key, score};
+    }
+
+    void clear();
+    size_t size_kb() const;
+
+    // Cheaper than the Zobrist hash for boards that don't already have one.
+    // Both halves are mixed: multiplying alone only carries differences
+    // upwards, so boards differing in their top rows would collide.
+    static uint64_t hash(board::Board b) {
+        return mix(mix(b.own) ^ b.opp);
+    }
+
+private:
+    static uint64_t mix(uint64_t h) {
+        h = (h ^ (h >> 32)) * 0xd6e8feb86659fd93;
+        h = (h ^ (h >> 32)) * 0xd6e8feb86659fd93;
+        return h ^ (h >> 32);
+    }
+
+    std::vector<EvalCacheEntry> entries;
+    uint64_t index_mask;
+};
@@ -0,0 +1,31 @@
+#include <iostream>
+#include <string>
+
+#include <fmt/core.h>
+
+#include "board.h"
+#include "common.h"
+#include "training_data.h"
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        cerr << "usage: extract_features features_out positions_in..." << endl;
+        cerr << "Reads positions written by parse_games, or lines of \"BOARD SCORE\" as written by" << endl;
+        cerr << "python/parse_wthor.py with X for the side to move and SCORE its final disc difference," << endl;
+        cerr << "and writes the pattern indices of each position for training." << endl;
+        exit(1);
+    }
+
+    training::FeatureWriter writer(argv[1]);
+    timestamp start = get_time();
+
+    for (int i = 2; i < argc; i++) {
+        training::read_positions(argv[i], [&](board::Board b, int score) { writer.add(b, score); });
+    }
+
+    uint64_t n_positions = writer.close();
+    float time_spent = get_time_since(start);
+    fmt::print(stderr, "{} positions in {:.2f}s @ {:.3e} positions/s\n",
+               n_positions, time_spent, n_positions / time_spent);
+}
@@ -1,50 +1,262 @@
 #include "hashtable.h"
 
 #include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
 #include <fmt/core.h>
 
 
-HashTable::HashTable() {
-    slots = new TableNode[N_SLOTS];
+// Huge page size on x86-64. The table is aligned to it so that it can be
+// backed by transparent huge pages, which cuts TLB misses on probes.
+const size_t HUGE_PAGE = 1 << 21;
 
-    zobrist_table = new uint32_t*[16];
+
+/* ====== ZOBRIST HASHING ====== */
+
+/*
+ * Each square has a random key for an own piece and one for an opponent piece,
+ * and the hash of a board is the XOR of the keys of its pieces. For hashing a
+ * whole board, the keys are combined per byte of the board so that it only
+ * takes 16 lookups.
+ */
+uint64_t zobrist_own[64];
+uint64_t zobrist_opp[64];
+uint64_t zobrist_bytes[16][256];
+
+bool init_zobrist() {
     srand(1337);
+    for (int i = 0; i < 64; i++) {
+        zobrist_own[i] = ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+        zobrist_opp[i] = ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+    }
+
+    // Bytes 0-7 of a board are own pieces, 8-15 opponent pieces.
     for (int i = 0; i < 16; i++) {
-        zobrist_table[i] = new uint32_t[256];
+        const uint64_t *keys = (i < 8) ? zobrist_own : zobrist_opp;
         for (int j = 0; j < 256; j++) {
-            zobrist_table[i][j] = rand() & MAX_HASH;
+            zobrist_bytes[i][j] = 0;
+            for (int bit = 0; bit < 8; bit++) {
+                if ((j >> bit) & 1) zobrist_bytes[i][j] ^= keys[(i % 8) * 8 + bit];
+            }
         }
     }
+
+    return true;
+}
+
+const bool zobrist_ready = init_zobrist();
+
+
+HashedBoard hashed(board::Board b) {
+    return {b, HashTable::hash(b), HashTable::hash(board::Board{b.opp, b.own})};
+}
+
+HashedBoard do_move(const HashedBoard &hb, int pos) {
+    return after_move(hb, pos, board::do_move(hb.b, pos));
+}
+
+/**
+ * Like do_move, for when the board after the move is already known.
+ */
+HashedBoard after_move(const HashedBoard &hb, int pos, board::Board after) {
+    if (pos == MOVE_PASS) return {after, hb.key_swapped, hb.key};
+
+    // Flipped discs change from opponent's to own before the sides swap.
+    uint64_t flipped_keys = 0;
+    uint64_t flipped = hb.b.opp ^ after.own;
+    while (flipped != 0ULL) {
+        int sq = __builtin_ctzll(flipped);
+        flipped &= flipped - 1;
+        flipped_keys ^= zobrist_own[sq] ^ zobrist_opp[sq];
+    }
+
+    return {
+        after,
+        hb.key_swapped ^ flipped_keys ^ zobrist_opp[pos],
+        hb.key ^ flipped_keys ^ zobrist_own[pos]
+    };
+}
+
+
+/* ====== ENTRY PACKING ====== */
+
+int16_t pack_score(int score) {
+    if (score == INT_MAX) return INT16_MAX;
+    if (score == -INT_MAX) return -INT16_MAX;
+    return max(-INT16_MAX + 1, min(INT16_MAX - 1, score));
+}
+
+int unpack_score(int16_t score) {
+    if (score == INT16_MAX) return INT_MAX;
+    if (score == -INT16_MAX) return -INT_MAX;
+    return score;
+}
+
+uint64_t pack(SearchNode val, uint8_t age) {
+    return (uint64_t)(uint16_t)pack_score(val.score)
+        | (uint64_t)(uint8_t)val.depth << 16
+        | (uint64_t)(uint8_t)val.best_move << 24
+        | (uint64_t)(uint8_t)val.type << 32
+        | (uint64_t)age << 40;
+}
+
+SearchNode unpack(uint64_t data) {
+    return {
+        (int8_t)(data >> 16),
+        (NodeType)(uint8_t)(data >> 32),
+        unpack_score((int16_t)data),
+        (int8_t)(data >> 24)
+    };
+}
+
+// Entries are read and written a word at a time with relaxed atomics, which
+// compile to plain moves but keep the compiler from splitting or merging them.
+uint64_t load_word(const uint64_t *word) {
+    return __atomic_load_n(word, __ATOMIC_RELAXED);
+}
+
+void store_word(uint64_t *word, uint64_t val) {
+    __atomic_store_n(word, val, __ATOMIC_RELAXED);
+}
+
+uint8_t data_depth(uint64_t data) { return data >> 16; }
+uint8_t data_type(uint64_t data) { return data >> 32; }
+uint8_t data_age(uint64_t data) { return data >> 40; }
+
+
+HashTable::HashTable(size_t mb, int n_threads) {
+    // Round the number of buckets down to a power of two that fits in mb.
+    n_buckets = 1;
+    while (n_buckets * 2 * sizeof(Bucket) <= mb << 20) n_buckets *= 2;
+    index_mask = n_buckets - 1;
+
+    size_t bytes = n_buckets * sizeof(Bucket);
+    size_t alloc_bytes = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    buckets = (Bucket *) aligned_alloc(HUGE_PAGE, alloc_bytes);
+    if (buckets == nullptr) {
+        fmt::print(stderr, "Could not allocate {} MB hashtable\n", alloc_bytes >> 20);
+        exit(1);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(buckets, alloc_bytes, MADV_HUGEPAGE);
+#endif
+
+    // Zero the table in parallel; this is also when the pages get faulted in.
+    n_threads = max(n_threads, 1);
+    vector<thread> zeroers;
+    size_t chunk = (bytes + n_threads - 1) / n_threads;
+    for (int i = 0; i < n_threads; i++) {
+        size_t begin = min(bytes, i * chunk);
+        size_t end = min(bytes, begin + chunk);
+        zeroers.emplace_back([this, begin, end]() {
+            memset((char *) buckets + begin, 0, end - begin);
+        });
+    }
+    for (auto &t : zeroers) t.join();
+
+    generation = 0;
 }
 
 HashTable::~HashTable() {
-    delete[] slots;
+    free(buckets);
+}
+
+
+/**
+ * Looks up key, giving true and filling val if it is found. Entries from
+ * previous searches are only returned if include_stale is set.
+ */
+bool HashTable::get(board::Board key, SearchNode &val, bool include_stale) {
+    return get(hash(key), val, include_stale);
 }
 
+bool HashTable::get(uint64_t h, SearchNode &val, bool include_stale) {
+    Bucket *bucket = &buckets[h & index_mask];
 
-SearchNode *HashTable::get(board::Board key) {
-    TableNode *node = &(slots[hash(key)]);
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        uint64_t check = load_word(&bucket->entries[i].check);
+        uint64_t data = load_word(&bucket->entries[i].data);
 
-    if (node->key == key) {
-        return &(node->val);
-    } else {
-        return nullptr;
+        if ((check ^ data) == h && (include_stale || data_age(data) == generation)) {
+            val = unpack(data);
+            return true;
+        }
     }
+
+    return false;
 }
 
 
+/**
+ * Stores val for key. If key isn't already in its bucket, the entry with the
+ * lowest replace_priority is overwritten.
+ */
 void HashTable::set(board::Board key, SearchNode val) {
-    slots[hash(key)] = {key, val};
+    set(hash(key), val);
+}
+
+void HashTable::set(uint64_t h, SearchNode val) {
+    Bucket *bucket = &buckets[h & index_mask];
+
+    // A torn entry only makes for a worse choice of entry to replace.
+    int replace = 0;
+    int replace_pri = INT_MAX;
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        uint64_t check = load_word(&bucket->entries[i].check);
+        uint64_t data = load_word(&bucket->entries[i].data);
+
+        if ((check ^ data) == h) {
+            replace = i;
+            break;
+        }
+        int pri = replace_priority(data);
+        if (pri < replace_pri) {
+            replace = i;
+            replace_pri = pri;
+        }
+    }
+
+    uint64_t data = pack(val, generation);
+    store_word(&bucket->entries[replace].check, h ^ data);
+    store_word(&bucket->entries[replace].data, data);
+}
+
+
+/**
+ * How much we'd rather keep an entry: entries from previous searches go
+ * first, then shallow ones. Exact scores are worth a couple plies of depth
+ * over bounds.
+ */
+int HashTable::replace_priority(uint64_t data) {
+    if (data_age(data) != generation) return -1;
+    return 4 * (int8_t)data_depth(data) + (data_type(data) == NodeType::PV ? 8 : 0);
+}
+
+
+/**
+ * Starts a new generation. Entries from earlier generations are replaced first,
+ * and are only used for move ordering.
+ */
+void HashTable::new_search() {
+    generation++;
+}
+
+
+size_t HashTable::size_mb() {
+    return (n_buckets * sizeof(Bucket)) >> 20;
 }
 
 
-size_t HashTable::hash(board::Board b) {
-    size_t ret = 0;
+uint64_t HashTable::hash(board::Board b) {
+    uint64_t ret = 0;
 
     // Loop through each byte of the board, XOR hash vals together
     const uint8_t *board_bytes = (const uint8_t *) &b;
     for (int i = 0; i < 16; i++) {
-        ret ^= zobrist_table[i][board_bytes[i]];
+        ret ^= zobrist_bytes[i][board_bytes[i]];
     }
 
     return ret;
@@ -4,24 +4,68 @@
 #include "common.h"
 
 
-#define N_SLOTS  0x200000
-#define MAX_HASH 0x1fffff
+#define DEFAULT_HASH_MB 64
 
 
+// Table entries are tagged with the generation (search) that wrote them, so
+// entries left over from earlier moves are the first to be replaced.
+// Positions are verified by their full 64-bit hash instead of the board, and
+// the rest of the entry is packed into one word:
+//   bits  0-15: score (clamped, +/-INT_MAX map to +/-INT16_MAX)
+//   bits 16-23: depth
+//   bits 24-31: best move
+//   bits 32-39: node type
+//   bits 40-47: generation
+//
+// Threads share the table without locks, so a reader can see the words of an
+// entry from two different writes. The hash is stored XORed with the data, so
+// such a torn entry fails to match its key instead of giving a wrong node.
 struct TableNode {
-    board::Board key;
-    SearchNode val;
+    uint64_t check;
+    uint64_t data;
 };
 
+// Entries that share a cache line. A key can be stored in any entry of the
+// bucket its hash points to.
+#define BUCKET_SIZE 4
+
+struct alignas(64) Bucket {
+    TableNode entries[BUCKET_SIZE];
+};
+
+// Board with its Zobrist hash, kept up to date by do_move from the placed
+// square and the flipped discs. Making a move swaps own and opp, so the hash
+// of the board seen from the other side is kept as well.
+struct HashedBoard {
+    board::Board b;
+    uint64_t key;
+    uint64_t key_swapped;
+};
+
+HashedBoard hashed(board::Board b);
+HashedBoard do_move(const HashedBoard &hb, int pos);
+HashedBoard after_move(const HashedBoard &hb, int pos, board::Board after);
+
 class HashTable {
 public:
-    HashTable();
+    HashTable(size_t mb = DEFAULT_HASH_MB, int n_threads = 1);
     ~HashTable();
-    SearchNode *get(board::Board key);
+    HashTable(const HashTable &) = delete;
+    HashTable &operator=(const HashTable &) = delete;
+    bool get(board::Board key, SearchNode &val, bool include_stale = false);
+    bool get(uint64_t h, SearchNode &val, bool include_stale = false);
     void set(board::Board key, SearchNode val);
-    size_t hash(board::Board b);
+    void set(uint64_t h, SearchNode val);
+    void prefetch(uint64_t h) { __builtin_prefetch(&buckets[h & index_mask]); }
+    void new_search();
+    size_t size_mb();
+    static uint64_t hash(board::Board b);
 private:
+    int replace_priority(uint64_t data);
+
     std::hash<uint64_t> hash_obj;
-    TableNode *slots;
-    uint32_t **zobrist_table;
+    Bucket *buckets;
+    size_t n_buckets;
+    uint64_t index_mask;
+    uint8_t generation;
 };
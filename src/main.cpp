@@ -5,6 +5,9 @@
 #include "pattern_eval.h"
 #include "book.h"
 #include "cpu.h"
+#include "endgame.h"
+#include "eval_cache.h"
+#include "hashtable.h"
 
 
 struct Options {
@@ -13,14 +16,20 @@ struct Options {
     int eg_depth;
     string weights_file;
     string book_file;
+    int threads;
+    int hash_mb;
+    int eval_cache_kb;
     int cs2;
 };
 
-const Options default_opts = {30, 15.0, 24, "weights.txt", "book.txt", 0};
+const Options default_opts = {30, 15.0, 24, "weights.txt", "book.txt", 1, DEFAULT_HASH_MB, DEFAULT_EVAL_CACHE_KB, 0};
+
+// Endgame nodes with at least this many empties are shared between threads.
+const int EG_SPLIT_EMPTIES = 14;
 
 
 void usage(char *argv[]) {
-    cerr << "Usage: " << argv[0] << " [-h] [--cs2] [-d DEPTH] [-t TIME] [-e EG_DEPTH] [-w WEIGHTS] [-b BOOK]" << endl << endl;
+    cerr << "Usage: " << argv[0] << " [-h] [--cs2] [-d DEPTH] [-t TIME] [-e EG_DEPTH] [-w WEIGHTS] [-b BOOK] [-j THREADS] [--hash MB] [--eval-cache KB]" << endl << endl;
     cerr << "\t-h, --help: print this message" << endl << endl;
     cerr << "\t--cs2: play using the CS2 protocol" << endl << endl;
     cerr << "\t-d DEPTH: search to a maximum depth of DEPTH in midgame (int).\t\t"
@@ -33,6 +42,12 @@ void usage(char *argv[]) {
          << "Default: " << default_opts.weights_file << endl;
     cerr << "\t-b BOOK: load opening book from the file at BOOK (str).\t\t\t"
          << "Default: " << default_opts.book_file << endl;
+    cerr << "\t-j THREADS: search with THREADS threads (int).\t\t\t\t"
+         << "Default: " << default_opts.threads << endl;
+    cerr << "\t--hash MB: use up to MB megabytes for each of the midgame and endgame hashtables (int).\t"
+         << "Default: " << default_opts.hash_mb << endl;
+    cerr << "\t--eval-cache KB: cache evaluations in KB kilobytes per thread, 0 for none (int).\t"
+         << "Default: " << default_opts.eval_cache_kb << endl;
 }
 
 
@@ -43,13 +58,16 @@ Options parse_opts(int argc, char *argv[]) {
     // format: {name, has_arg, *flag, val}
     static struct option long_opts[] = {
         {"cs2", no_argument, &ret.cs2, 1},
-        {"help", no_argument, NULL, 'h'}
+        {"help", no_argument, NULL, 'h'},
+        {"hash", required_argument, NULL, 'H'},
+        {"eval-cache", required_argument, NULL, 'E'},
+        {0, 0, 0, 0}
     };
 
     // Use GNU getopt to parse args.
     int optchar;
     int optidx = 0;
-    while ((optchar = getopt_long(argc, argv, "hd:t:e:w:b:", long_opts, &optidx)) != -1) {
+    while ((optchar = getopt_long(argc, argv, "hd:t:e:w:b:j:", long_opts, &optidx)) != -1) {
         switch (optchar) {
             case 0:
                 // Case for long_opts. getopt_long will already set the flag, so do nothing.
@@ -78,6 +96,18 @@ Options parse_opts(int argc, char *argv[]) {
                 cerr << "Using book file " << optarg << endl;
                 ret.book_file = optarg;
                 break;
+            case 'j':
+                cerr << "Using " << optarg << " threads" << endl;
+                ret.threads = max(1, std::stoi(optarg));
+                break;
+            case 'H':
+                cerr << "Using " << optarg << " MB hashtable" << endl;
+                ret.hash_mb = max(1, std::stoi(optarg));
+                break;
+            case 'E':
+                cerr << "Using " << optarg << " KB eval cache" << endl;
+                ret.eval_cache_kb = max(0, std::stoi(optarg));
+                break;
             default:
                 usage(argv);
                 exit(1);
@@ -133,7 +163,11 @@ void cli_play(Options opts) {
     board::Board board = board::starting_position();
     eval::load_weights(opts.weights_file);
     book::load_book(opts.book_file);
-    CPU cpu{opts.max_depth, opts.max_time, opts.eg_depth, true};
+    CPU cpu{opts.max_depth, opts.max_time, opts.eg_depth, true, opts.threads, (size_t)opts.hash_mb,
+            (size_t)opts.eval_cache_kb};
+
+    // Helpers start once everything that can fail has loaded.
+    endgame::start_threads(opts.threads - 1, EG_SPLIT_EMPTIES);
 
     vector<board::Board> history;
     bool turn = BLACK;
@@ -203,7 +237,11 @@ void cs2_play(Options opts, bool bot_color) {
     board::Board b = board::starting_position();
     eval::load_weights(opts.weights_file);
     book::load_book(opts.book_file);
-    CPU cpu{opts.max_depth, opts.max_time, opts.eg_depth, true};
+    CPU cpu{opts.max_depth, opts.max_time, opts.eg_depth, true, opts.threads, (size_t)opts.hash_mb,
+            (size_t)opts.eval_cache_kb};
+
+    // Helpers start once everything that can fail has loaded.
+    endgame::start_threads(opts.threads - 1, EG_SPLIT_EMPTIES);
 
     cout << "Init done.\n";
 
@@ -250,6 +288,8 @@ void cs2_play(Options opts, bool bot_color) {
 int main(int argc, char *argv[]) {
     Options opts = parse_opts(argc, argv);
 
+    endgame::set_hashtable(opts.hash_mb, DEFAULT_EG_HASH_EMPTIES);
+
     if (opts.cs2) {
         // The last arg should specify color.
         string color_arg = argv[argc - 1];
@@ -266,5 +306,7 @@ int main(int argc, char *argv[]) {
         cli_play(opts);
     }
 
+    endgame::stop_threads();
+
     return 0;
 }
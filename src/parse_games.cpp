@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fmt/core.h>
+
+#include "board.h"
+#include "common.h"
+#include "training_data.h"
+
+
+struct ParseOptions {
+    int threads;
+    string out_file;
+};
+
+const ParseOptions default_opts = {1, "positions.bin"};
+
+// WTHOR databases: a file header, then fixed-size games of a game header and
+// 60 moves, each a byte 10 * row + col counting from 1, or 0 after the end.
+// Passes aren't recorded.
+const size_t WTHOR_HEADER_BYTES = 16;
+const size_t WTHOR_GAME_BYTES = 68;
+const size_t WTHOR_GAME_HEADER_BYTES = 8;
+
+
+void usage(char *argv[]) {
+    cerr << "Usage: " << argv[0] << " [-j THREADS] [-o POSITIONS] GAMES..." << endl << endl;
+    cerr << "Replays the games of WTHOR databases (.wtb) and Logistello game files (any other" << endl;
+    cerr << "extension, one game per line as \"+d3-c3+c4...:\"), and writes every position" << endl;
+    cerr << "reached with the final disc difference, once per distinct position." << endl << endl;
+    cerr << "\t-j THREADS: replay games with THREADS threads (int).\t"
+         << "Default: " << default_opts.threads << endl;
+    cerr << "\t-o POSITIONS: write positions to POSITIONS (str).\t"
+         << "Default: " << default_opts.out_file << endl;
+}
+
+
+ParseOptions parse_opts(int argc, char *argv[]) {
+    ParseOptions ret = default_opts;
+
+    static struct option long_opts[] = {
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int optchar;
+    int optidx = 0;
+    while ((optchar = getopt_long(argc, argv, "hj:o:", long_opts, &optidx)) != -1) {
+        switch (optchar) {
+            case 'j': ret.threads = max(1, std::stoi(optarg)); break;
+            case 'o': ret.out_file = optarg; break;
+            case 'h':
+                usage(argv);
+                exit(0);
+            default:
+                usage(argv);
+                exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv);
+        exit(1);
+    }
+
+    return ret;
+}
+
+
+// A game's bytes in a mapped file.
+struct GameText {
+    const char *data;
+    size_t size;
+    bool wthor;
+};
+
+// Position reached in a game, from the side to move, with its final disc
+// difference.
+struct GamePosition {
+    board::Board b;
+    int score;
+};
+
+
+const char *map_file(const string &filename, size_t &size) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        cerr << "Could not open games file " << filename << endl;
+        exit(1);
+    }
+
+    size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    const char *data = (const char *) mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        cerr << "Could not map games file " << filename << endl;
+        exit(1);
+    }
+
+    return data;
+}
+
+
+/**
+ * Splits a mapped file into games. The mapping is kept until the program
+ * exits.
+ */
+void split_games(const string &filename, vector<GameText> &games) {
+    size_t size;
+    const char *data = map_file(filename, size);
+
+    bool wthor = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".wtb") == 0;
+    if (wthor) {
+        if (size < WTHOR_HEADER_BYTES || (size - WTHOR_HEADER_BYTES) % WTHOR_GAME_BYTES != 0) {
+            cerr << "WTHOR file " << filename << " has " << size << " bytes, not a whole number of games" << endl;
+            exit(1);
+        }
+        for (size_t i = WTHOR_HEADER_BYTES; i < size; i += WTHOR_GAME_BYTES) {
+            games.push_back({data + i, WTHOR_GAME_BYTES, true});
+        }
+        return;
+    }
+
+    size_t start = 0;
+    while (start < size) {
+        const char *newline = (const char *) memchr(data + start, '\n', size - start);
+        size_t end = newline ? newline - data : size;
+        if (end > start) games.push_back({data + start, end - start, false});
+        start = end + 1;
+    }
+}
+
+
+/**
+ * Gives the moves of a game as squares, with the side that played each move:
+ * PIECE_OWN for black. For WTHOR games, which don't record passes, the side
+ * is worked out while replaying, so it is left as PIECE_OWN.
+ */
+bool game_moves(const GameText &game, vector<int> &moves, vector<bool> &sides) {
+    if (game.wthor) {
+        for (size_t i = WTHOR_GAME_HEADER_BYTES; i < game.size; i++) {
+            int code = (uint8_t) game.data[i];
+            if (code == 0) break;
+            int row = code / 10 - 1, col = code % 10 - 1;
+            if (row < 0 || row > 7 || col < 0 || col > 7) return false;
+            moves.push_back(row * 8 + col);
+            sides.push_back(PIECE_OWN);
+        }
+        return true;
+    }
+
+    // Logistello: "+d3-c3..." until the ':' before the result.
+    for (size_t i = 0; i + 2 < game.size && game.data[i] != ':'; i += 3) {
+        char sign = game.data[i], col_ch = game.data[i + 1], row_ch = game.data[i + 2];
+        if ((sign != '+' && sign != '-') || col_ch < 'a' || col_ch > 'h' || row_ch < '1' || row_ch > '8') return false;
+        moves.push_back((row_ch - '1') * 8 + (col_ch - 'a'));
+        sides.push_back(sign == '+' ? PIECE_OWN : PIECE_OPP);
+    }
+    return true;
+}
+
+
+/**
+ * Replays a game, adding the position before each move to positions. Gives
+ * false, adding nothing, if a move is illegal or is listed for the wrong
+ * player.
+ */
+bool replay(const GameText &game, vector<GamePosition> &positions) {
+    vector<int> moves;
+    vector<bool> sides;
+    if (!game_moves(game, moves, sides) || moves.empty()) return false;
+
+    // Board from black's side; black_to_move says whose move it is.
+    board::Board b = board::starting_position();
+    bool black_to_move = true;
+    size_t first = positions.size();
+
+    for (size_t i = 0; i < moves.size(); i++) {
+        board::Board to_move = black_to_move ? b : board::Board{b.opp, b.own};
+
+        // Pass if the player to move can't. Logistello games also list who
+        // moves, which has to be the player left to move.
+        if (board::get_moves(to_move) == 0ULL) {
+            black_to_move = !black_to_move;
+            to_move = board::Board{to_move.opp, to_move.own};
+        }
+        bool listed_black = sides[i] == PIECE_OWN;
+
+        uint64_t move_bit = 1ULL << moves[i];
+        if ((!game.wthor && listed_black != black_to_move) || !(board::get_moves(to_move) & move_bit)) {
+            positions.resize(first);
+            return false;
+        }
+
+        // Score is filled in at the end, from black's side for now.
+        positions.push_back({to_move, black_to_move ? 1 : -1});
+
+        to_move = board::do_move(to_move, moves[i]);
+        b = black_to_move ? board::Board{to_move.opp, to_move.own} : board::Board{to_move.own, to_move.opp};
+        black_to_move = !black_to_move;
+    }
+
+    int black_score = board::popcount(b.own) - board::popcount(b.opp);
+    for (size_t i = first; i < positions.size(); i++) positions[i].score *= black_score;
+    return true;
+}
+
+
+bool board_less(const GamePosition &p1, const GamePosition &p2) {
+    return p1.b.own < p2.b.own || (p1.b.own == p2.b.own && p1.b.opp < p2.b.opp);
+}
+
+
+/**
+ * Merges repeats of a position into one record with their average score.
+ * Positions must be sorted by board_less.
+ */
+vector<training::PositionRecord> dedupe(const vector<GamePosition> &positions) {
+    vector<training::PositionRecord> ret;
+    size_t i = 0;
+    while (i < positions.size()) {
+        size_t j = i;
+        int total = 0;
+        while (j < positions.size() && positions[j].b == positions[i].b) total += positions[j++].score;
+
+        int count = j - i;
+        int score = (int)lround((double)total / count);
+        ret.push_back({positions[i].b.own, positions[i].b.opp, (int8_t)score, (uint8_t)min(count, 255)});
+        i = j;
+    }
+
+    return ret;
+}
+
+
+int main(int argc, char *argv[]) {
+    ParseOptions opts = parse_opts(argc, argv);
+    timestamp start = get_time();
+
+    vector<GameText> games;
+    for (int i = optind; i < argc; i++) split_games(argv[i], games);
+
+    // Each thread replays a share of the games and sorts its positions.
+    vector<vector<GamePosition>> positions(opts.threads);
+    vector<long> bad_games(opts.threads, 0L);
+    vector<thread> threads;
+    for (int t = 0; t < opts.threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t g = t; g < games.size(); g += opts.threads) {
+                if (!replay(games[g], positions[t])) bad_games[t]++;
+            }
+            sort(positions[t].begin(), positions[t].end(), board_less);
+        });
+    }
+    for (auto &t : threads) t.join();
+
+    // Merge the sorted shares.
+    vector<GamePosition> all;
+    long n_bad = 0L;
+    for (int t = 0; t < opts.threads; t++) {
+        size_t middle = all.size();
+        all.insert(all.end(), positions[t].begin(), positions[t].end());
+        inplace_merge(all.begin(), all.begin() + middle, all.end(), board_less);
+        vector<GamePosition>().swap(positions[t]);
+        n_bad += bad_games[t];
+    }
+    size_t n_all = all.size();
+
+    vector<training::PositionRecord> records = dedupe(all);
+    training::write_positions(opts.out_file, records);
+
+    fmt::print(stderr, "{} games ({} skipped with illegal moves), {} positions, {} distinct, in {:.2f}s\n",
+               games.size(), n_bad, n_all, records.size(), get_time_since(start));
+}
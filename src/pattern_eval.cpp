@@ -1,57 +1,432 @@
 #include "pattern_eval.h"
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <immintrin.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
 
 
 namespace eval {
 
 
-int16_t weights[total_instances];
+int16_t text_weights[total_instances + 1];
+
+// Points into the mapped file for binary weights, or to text_weights. There
+// is always something readable after the last weight (the checksum, or a
+// spare weight), so that score_batch can read weights as 32-bit words. Until
+// weights are loaded, every weight is zero, as eg_test expects.
+const int16_t *weights = text_weights;
 int16_t weight_intercept;
 
 
-inline int score_pat(uint64_t own, uint64_t opp, size_t mask_idx) {
-    uint64_t mask = masks[mask_idx];
+// Index into weights of pattern p on the board.
+template <int p>
+inline int pattern_index(uint64_t own, uint64_t opp) {
+    constexpr uint64_t mask = patterns[p].mask;
     uint64_t own_bits = pext(own, mask);
     uint64_t opp_bits = pext(opp, mask);
 
     // Determine index into weights array from pattern and instance
     uint16_t instance =  2 * ternary_ones[own_bits] + ternary_ones[opp_bits];
-    uint16_t weight_idx = pattern_start[mask_idx] + instance;
+    return pattern_start[p] + instance;
+}
 
-    return weights[weight_idx];
+// Sum of the weights of every instance, unrolled at compile time. The flips
+// are constants, so each flipped board is computed once and only if a pattern
+// is matched on it.
+template <size_t... i>
+inline int score_instances(board::Board b, index_sequence<i...>) {
+    int score = 0;
+    ((score += weights[pattern_index<instances[i].pattern>(flip(b.own, instances[i].flip),
+                                                           flip(b.opp, instances[i].flip))]), ...);
+    return score;
 }
 
 int score(board::Board b) {
-    int score = -weight_intercept;
+    return -weight_intercept + score_instances(b, make_index_sequence<N_ALL_MASKS>());
+}
+
+
+template <size_t... i>
+inline void activate_instances(int *ret, board::Board b, index_sequence<i...>) {
+    ((ret[i] = pattern_index<instances[i].pattern>(flip(b.own, instances[i].flip),
+                                                   flip(b.opp, instances[i].flip))), ...);
+}
 
-    // Diagonal-aligned masks
-    for (size_t mask_idx = 0; mask_idx < 4; mask_idx++) {
-        score += score_pat(b.own, b.opp, mask_idx);
-        score += score_pat(flip_adiag(b.own), flip_adiag(b.opp), mask_idx);
-        score += score_pat(flip_vert(b.own), flip_vert(b.opp), mask_idx);
-        score += score_pat(flip_horiz(b.own), flip_horiz(b.opp), mask_idx);
+/**
+ * Gives the index into weights of every instance on the board, in the order
+ * of instances, so that score is -intercept plus the sum of their weights.
+ * ret must have room for N_ALL_MASKS indices.
+ */
+void pattern_activations(int *ret, board::Board b) {
+    activate_instances(ret, b, make_index_sequence<N_ALL_MASKS>());
+}
+
+
+/* ====== INCREMENTAL EVALUATION ====== */
+
+// What an opponent's piece on each square adds to the index of each instance
+// (an own piece adds twice as much): 3^k if the square is the kth bit of the
+// instance's mask, otherwise 0. Padding instances are always 0.
+alignas(32) uint16_t square_values[64][N_INDICES];
+
+bool init_square_values() {
+    for (int sq = 0; sq < 64; sq++) {
+        for (int i = 0; i < N_ALL_MASKS; i++) {
+            uint64_t mask = patterns[instances[i].pattern].mask;
+            uint64_t bit = flip(1ULL << sq, instances[i].flip);
+            square_values[sq][i] = (mask & bit) ? ternary_ones[pext(bit, mask)] : 0;
+        }
     }
 
-    // Long diagonal
-    score += score_pat(b.own, b.opp, DIAG_8);
-    score += score_pat(flip_vert(b.own), flip_vert(b.opp), DIAG_8);
+    return true;
+}
+
+const bool square_values_ready = init_square_values();
 
-    // Edge-aligned masks
-    for (size_t mask_idx = 5; mask_idx < 9; mask_idx++) {
-        score += score_pat(b.own, b.opp, mask_idx);
-        score += score_pat(flip_vert(b.own), flip_vert(b.opp), mask_idx);
-        score += score_pat(flip_diag(b.own), flip_diag(b.opp), mask_idx);
-        score += score_pat(flip_adiag(b.own), flip_adiag(b.opp), mask_idx);
+
+PatternBoard patterned(board::Board b) {
+    PatternBoard ret = {b, {}, {}};
+
+    uint64_t own[N_FLIPS], opp[N_FLIPS];
+    for (int f = 0; f < N_FLIPS; f++) {
+        own[f] = flip(b.own, (Flip)f);
+        opp[f] = flip(b.opp, (Flip)f);
+    }
+
+    for (int i = 0; i < N_ALL_MASKS; i++) {
+        int pattern = instances[i].pattern;
+        uint64_t mask = patterns[pattern].mask;
+
+        uint16_t own_ternary = ternary_ones[pext(own[instances[i].flip], mask)];
+        uint16_t opp_ternary = ternary_ones[pext(opp[instances[i].flip], mask)];
+        ret.idx[i] = pattern_start[pattern] + 2 * own_ternary + opp_ternary;
+        ret.idx_swapped[i] = pattern_start[pattern] + 2 * opp_ternary + own_ternary;
+    }
+
+    return ret;
+}
+
+
+PatternBoard do_move(const PatternBoard &pb, int pos) {
+    board::Board after = board::do_move(pb.b, pos);
+    PatternBoard ret;
+    ret.b = after;
+
+    if (pos == MOVE_PASS) {
+        memcpy(ret.idx, pb.idx_swapped, sizeof(ret.idx));
+        memcpy(ret.idx_swapped, pb.idx, sizeof(ret.idx));
+        return ret;
+    }
+
+    // Flipped discs go from the opponent's to our own, which adds their
+    // values once more to our indices and takes them away once from the
+    // opponent's.
+    alignas(32) uint16_t flipped_values[N_INDICES] = {};
+    uint64_t flipped = pb.b.opp ^ after.own;
+    while (flipped != 0ULL) {
+        int sq = __builtin_ctzll(flipped);
+        flipped &= flipped - 1;
+        for (int i = 0; i < N_INDICES; i++) flipped_values[i] += square_values[sq][i];
+    }
+
+    // The sides swap: the mover's indices become idx_swapped.
+    for (int i = 0; i < N_INDICES; i++) {
+        ret.idx[i] = pb.idx_swapped[i] + square_values[pos][i] - flipped_values[i];
+        ret.idx_swapped[i] = pb.idx[i] + 2 * square_values[pos][i] + flipped_values[i];
     }
 
+    return ret;
+}
+
+
+/**
+ * Same as score(pb.b), without working out the pattern instances.
+ */
+int score(const PatternBoard &pb) {
+    int score = -weight_intercept;
+    for (int i = 0; i < N_ALL_MASKS; i++) {
+        score += weights[pb.idx[i]];
+    }
     return score;
 }
 
 
+/* ====== BATCHED EVALUATION ====== */
+
+#ifdef __AVX2__
+
+/*
+ * score_batch works on eight boards at once, with the low and high halves of
+ * each board in 32-bit lanes. There is no pext, so instead of flipping the
+ * board, each instance's bits are gathered from the squares it covers on the
+ * unflipped board: rows and diagonals have one bit per file, so ORing the
+ * rows together leaves them in one byte by file, and columns are gathered by
+ * rank with a multiply. Those bytes are in the same or the opposite order to
+ * pext's, and are shifted so they line up with the ternary tables. Pattern
+ * sets with other shapes are scored one board at a time.
+ */
+struct BatchInstance {
+    uint32_t mask_lo;
+    uint32_t mask_hi;
+    int column;         // file of a column instance, or -1
+    int shift_right;    // to line the bits up with the ternary tables
+    int shift_left;
+    bool reversed;      // bits go the opposite way to pext's
+    uint16_t start;
+};
+
+BatchInstance batch_instances[N_ALL_MASKS];
+
+// Number of row and diagonal instances, which batch_instances keeps ahead of
+// the columns: instances whose squares are all on one file are columns.
+constexpr int count_row_instances() {
+    int ret = 0;
+    for (int i = 0; i < N_ALL_MASKS; i++) {
+        uint64_t files = 0ULL;
+        for (int sq = 0; sq < 64; sq++) {
+            if (patterns[instances[i].pattern].mask & flip(1ULL << sq, instances[i].flip)) files |= 1ULL << (sq % 8);
+        }
+        if (__builtin_popcountll(files) != 1) ret++;
+    }
+    return ret;
+}
+
+constexpr int N_ROW_INSTANCES = count_row_instances();
+
+bool init_batch_instances() {
+    int n = 0;
+
+    // Columns last, so the two kinds can be looped over separately.
+    for (int want_column = 0; want_column < 2; want_column++) {
+        for (int i = 0; i < N_ALL_MASKS; i++) {
+            uint64_t squares = 0ULL;
+            uint64_t files = 0ULL;
+            for (int sq = 0; sq < 64; sq++) {
+                if (square_values[sq][i] == 0) continue;
+                squares |= 1ULL << sq;
+                files |= 1ULL << (sq % 8);
+            }
+
+            bool column = board::popcount(files) == 1;
+            if (column != (bool)want_column) continue;
+            if (!column && board::popcount(files) != board::popcount(squares)) return false;
+
+            // Position of each square in the byte of bits, and in pext's order.
+            int lowest = 8, highest = -1;
+            bool forward = true, backward = true;
+            for (int sq = 0; sq < 64; sq++) {
+                if (square_values[sq][i] == 0) continue;
+                int bit = column ? sq / 8 : sq % 8;
+                lowest = min(lowest, bit);
+                highest = max(highest, bit);
+            }
+            for (int sq = 0; sq < 64; sq++) {
+                if (square_values[sq][i] == 0) continue;
+                int bit = column ? sq / 8 : sq % 8;
+                uint16_t value = square_values[sq][i];
+                uint16_t forward_value = 1, backward_value = 1;
+                for (int k = 0; k < bit - lowest; k++) forward_value *= 3;
+                for (int k = 0; k < highest - bit; k++) backward_value *= 3;
+                forward &= value == forward_value;
+                backward &= value == backward_value;
+            }
+            if (!forward && !backward) return false;
+
+            BatchInstance &bi = batch_instances[n++];
+            bi.mask_lo = (uint32_t)squares;
+            bi.mask_hi = (uint32_t)(squares >> 32);
+            bi.column = column ? __builtin_ctzll(files) : -1;
+            bi.reversed = !forward;
+            bi.shift_right = forward ? lowest : 0;
+            bi.shift_left = forward ? 0 : 7 - highest;
+            bi.start = pattern_start[instances[i].pattern];
+        }
+    }
+
+    return true;
+}
+
+const bool batchable = init_batch_instances();
+
+
+// Bits of a row or diagonal instance in the low byte of each lane, by file.
+inline __m256i row_bits_x8(__m256i lo, __m256i hi, const BatchInstance &bi) {
+    __m256i x = _mm256_or_si256(_mm256_and_si256(lo, _mm256_set1_epi32(bi.mask_lo)),
+                                _mm256_and_si256(hi, _mm256_set1_epi32(bi.mask_hi)));
+    x = _mm256_or_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_or_si256(x, _mm256_srli_epi32(x, 8));
+    return _mm256_and_si256(x, _mm256_set1_epi32(0xff));
+}
+
+// Bits of a column instance in the low byte of each lane, by rank. The
+// multiply moves the bit of rank k in a half from 8k to 24 + k.
+inline __m256i column_bits_x8(__m256i lo, __m256i hi, const BatchInstance &bi) {
+    const __m256i gather = _mm256_set1_epi32(0x01020408);
+    __m128i shift = _mm_cvtsi32_si128(bi.column);
+    lo = _mm256_srl_epi32(_mm256_and_si256(lo, _mm256_set1_epi32(bi.mask_lo)), shift);
+    hi = _mm256_srl_epi32(_mm256_and_si256(hi, _mm256_set1_epi32(bi.mask_hi)), shift);
+    lo = _mm256_srli_epi32(_mm256_mullo_epi32(lo, gather), 24);
+    hi = _mm256_srli_epi32(_mm256_mullo_epi32(hi, gather), 20);
+    return _mm256_and_si256(_mm256_or_si256(lo, hi), _mm256_set1_epi32(0xff));
+}
+
+/**
+ * Adds the weight of one instance to sum, given the own and opp bits of the
+ * instance. Ternary values are looked up a nibble at a time with shuffles,
+ * with own and opp side by side in the low two bytes of each lane.
+ */
+inline __m256i add_weight_x8(__m256i sum, __m256i own, __m256i opp, const BatchInstance &bi) {
+    const __m256i nibble_fwd = _mm256_setr_epi8(
+        0, 1, 3, 4, 9, 10, 12, 13, 27, 28, 30, 31, 36, 37, 39, 40,
+        0, 1, 3, 4, 9, 10, 12, 13, 27, 28, 30, 31, 36, 37, 39, 40);
+    const __m256i nibble_rev = _mm256_setr_epi8(
+        0, 27, 9, 36, 3, 30, 12, 39, 1, 28, 10, 37, 4, 31, 13, 40,
+        0, 27, 9, 36, 3, 30, 12, 39, 1, 28, 10, 37, 4, 31, 13, 40);
+    const __m256i low_nibbles = _mm256_set1_epi32(0x0f0f);
+    const __m256i own_opp = _mm256_set1_epi32(0x0102);  // weights of the bytes in maddubs
+
+    __m256i bits = _mm256_or_si256(own, _mm256_slli_epi32(opp, 8));
+    bits = _mm256_srl_epi32(bits, _mm_cvtsi32_si128(bi.shift_right));
+    bits = _mm256_sll_epi32(bits, _mm_cvtsi32_si128(bi.shift_left));
+    bits = _mm256_and_si256(bits, _mm256_set1_epi32(0xffff));  // undo carries between the bytes
+    __m256i lo = _mm256_and_si256(bits, low_nibbles);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(bits, 4), low_nibbles);
+
+    // Reversed bits put the low nibble in the high ternary digits.
+    __m256i low_digits, high_digits;
+    if (bi.reversed) {
+        low_digits = _mm256_shuffle_epi8(nibble_rev, hi);
+        high_digits = _mm256_shuffle_epi8(nibble_rev, lo);
+    } else {
+        low_digits = _mm256_shuffle_epi8(nibble_fwd, lo);
+        high_digits = _mm256_shuffle_epi8(nibble_fwd, hi);
+    }
+    low_digits = _mm256_maddubs_epi16(low_digits, own_opp);
+    high_digits = _mm256_maddubs_epi16(high_digits, own_opp);
+
+    __m256i idx = _mm256_add_epi32(_mm256_set1_epi32(bi.start),
+                                   _mm256_madd_epi16(_mm256_or_si256(low_digits, _mm256_slli_epi32(high_digits, 16)),
+                                                     _mm256_set1_epi32(81 << 16 | 1)));
+
+    // Gathers read 32 bits from each weight, of which the low 16 are it.
+    __m256i w = _mm256_i32gather_epi32((const int *) weights, idx, 2);
+    return _mm256_add_epi32(sum, _mm256_srai_epi32(_mm256_slli_epi32(w, 16), 16));
+}
+
+/**
+ * Scores eight boards, given as the low and high halves of own and opp.
+ */
+inline __m256i score_x8(__m256i own_lo, __m256i own_hi, __m256i opp_lo, __m256i opp_hi) {
+    __m256i sum = _mm256_set1_epi32(-weight_intercept);
+
+    int i = 0;
+    for (; i < N_ROW_INSTANCES; i++) {
+        const BatchInstance &bi = batch_instances[i];
+        sum = add_weight_x8(sum, row_bits_x8(own_lo, own_hi, bi), row_bits_x8(opp_lo, opp_hi, bi), bi);
+    }
+    for (; i < N_ALL_MASKS; i++) {
+        const BatchInstance &bi = batch_instances[i];
+        sum = add_weight_x8(sum, column_bits_x8(own_lo, own_hi, bi), column_bits_x8(opp_lo, opp_hi, bi), bi);
+    }
+
+    return sum;
+}
+
+#endif
+
+
+/**
+ * Scores n boards into scores, the same as calling score on each. With AVX2,
+ * boards are scored eight at a time.
+ */
+void score_batch(const board::Board *boards, int n, int *scores) {
+    int i = 0;
+
+#ifdef __AVX2__
+    // 32-bit words of each board, in order own low, own high, opp low, opp high.
+    const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    for (; batchable && i + 8 <= n; i += 8) {
+        const int *words = (const int *) (boards + i);
+        __m256i own_lo = _mm256_i32gather_epi32(words, stride, 4);
+        __m256i own_hi = _mm256_i32gather_epi32(words + 1, stride, 4);
+        __m256i opp_lo = _mm256_i32gather_epi32(words + 2, stride, 4);
+        __m256i opp_hi = _mm256_i32gather_epi32(words + 3, stride, 4);
+        _mm256_storeu_si256((__m256i *) &scores[i], score_x8(own_lo, own_hi, opp_lo, opp_hi));
+    }
+#endif
+
+    for (; i < n; i++) {
+        scores[i] = score(boards[i]);
+    }
+}
+
+
+/*
+ * Binary weights file layout, in native byte order:
+ *   WeightsHeader
+ *   int16_t weights[n_weights]
+ *   uint64_t checksum of everything before it
+ */
+const char WEIGHTS_MAGIC[4] = {'W', 'K', 'W', 'T'};
+const uint32_t WEIGHTS_VERSION = 1;
+
+struct WeightsHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t n_weights;
+    int32_t intercept;
+};
+
+
+// FNV-1a
+uint64_t checksum(const char *data, size_t len) {
+    uint64_t ret = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; i++) {
+        ret = (ret ^ (uint8_t)data[i]) * 0x100000001b3;
+    }
+    return ret;
+}
+
+
+/**
+ * Returns the binary weights next to a text weights file (weights.bin for
+ * weights.txt) if they exist and are at least as new as the text, otherwise
+ * the file itself.
+ */
+string binary_weights_for(const string &filename) {
+    const string ext = ".txt";
+    if (filename.size() < ext.size() || filename.compare(filename.size() - ext.size(), ext.size(), ext) != 0) {
+        return filename;
+    }
+
+    string binary = filename.substr(0, filename.size() - ext.size()) + ".bin";
+    struct stat text_st, binary_st;
+    if (stat(binary.c_str(), &binary_st) < 0 || stat(filename.c_str(), &text_st) < 0) {
+        return filename;
+    }
+    if (binary_st.st_mtime < text_st.st_mtime) {
+        cerr << binary << " is older than " << filename << ", loading the text weights" << endl;
+        return filename;
+    }
+    return binary;
+}
+
+
+/**
+ * Loads weights from the binary format if the file starts with its magic
+ * number, otherwise from text: the intercept then each weight. A text file
+ * is skipped in favour of its up-to-date binary conversion, so that the
+ * default weights.txt is mapped rather than parsed once converted.
+ */
 void load_weights(string filename) {
+    filename = binary_weights_for(filename);
     ifstream weights_file(filename);
 
     if (!weights_file.is_open()) {
@@ -59,67 +434,101 @@ void load_weights(string filename) {
         exit(1);
     }
 
-    try {
-        weights_file >> weight_intercept;
-    } catch (...) {
-        cerr << "\nError loading weights\n";
-        exit(1);
+    char magic[4] = {};
+    weights_file.read(magic, sizeof(magic));
+    if (memcmp(magic, WEIGHTS_MAGIC, sizeof(magic)) == 0) {
+        weights_file.close();
+        load_weights_binary(filename);
+        return;
     }
 
+    weights_file.clear();
+    weights_file.seekg(0);
+
+    weights_file >> weight_intercept;
     for (int i = 0; i < total_instances; i++) {
-        try {
-            weights_file >> weights[i];
-        } catch (...) {
-            cerr << "\nError loading weights\n";
-            exit(1);
-        }
+        weights_file >> text_weights[i];
+    }
+
+    if (!weights_file) {
+        cerr << "\nError loading weights\n";
+        exit(1);
     }
 
+    weights = text_weights;
     weights_file.close();
 }
 
 
-// Utility functions for different flips of masks
-uint64_t flip_vert(uint64_t x) {
-    return __builtin_bswap64(x);
-}
-
-uint64_t flip_horiz(uint64_t x) {
-    const uint64_t k1 = 0x5555555555555555;
-    const uint64_t k2 = 0x3333333333333333;
-    const uint64_t k4 = 0x0f0f0f0f0f0f0f0f;
-    x = ((x >> 1) & k1) +  2*(x & k1);
-    x = ((x >> 2) & k2) +  4*(x & k2);
-    x = ((x >> 4) & k4) + 16*(x & k4);
-    return x;
-}
-
-uint64_t flip_diag(uint64_t x) {
-    uint64_t t;
-    const uint64_t k1 = 0x5500550055005500;
-    const uint64_t k2 = 0x3333000033330000;
-    const uint64_t k4 = 0x0f0f0f0f00000000;
-    t  = k4 & (x ^ (x << 28));
-    x ^=       t ^ (t >> 28) ;
-    t  = k2 & (x ^ (x << 14));
-    x ^=       t ^ (t >> 14) ;
-    t  = k1 & (x ^ (x <<  7));
-    x ^=       t ^ (t >>  7) ;
-    return x;
-}
-
-uint64_t flip_adiag(uint64_t x) {
-    uint64_t t;
-    const uint64_t k1 = 0xaa00aa00aa00aa00;
-    const uint64_t k2 = 0xcccc0000cccc0000;
-    const uint64_t k4 = 0xf0f0f0f00f0f0f0f;
-    t  =       x ^ (x << 36) ;
-    x ^= k4 & (t ^ (x >> 36));
-    t  = k2 & (x ^ (x << 18));
-    x ^=       t ^ (t >> 18) ;
-    t  = k1 & (x ^ (x <<  9));
-    x ^=       t ^ (t >>  9) ;
-    return x;
+/**
+ * Maps a binary weights file into memory and uses the weights in place. The
+ * mapping is kept until the program exits.
+ */
+void load_weights_binary(string filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        cerr << "Could not open weights file" << endl;
+        exit(1);
+    }
+
+    size_t expected = sizeof(WeightsHeader) + total_instances * sizeof(int16_t) + sizeof(uint64_t);
+    if ((size_t)st.st_size != expected) {
+        cerr << "Weights file " << filename << " has " << st.st_size << " bytes, expected " << expected << endl;
+        exit(1);
+    }
+
+    const char *data = (const char *) mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        cerr << "Could not map weights file" << endl;
+        exit(1);
+    }
+
+    WeightsHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, WEIGHTS_MAGIC, sizeof(header.magic)) != 0
+            || header.version != WEIGHTS_VERSION || header.n_weights != total_instances) {
+        cerr << "Weights file " << filename << " has the wrong version or number of weights" << endl;
+        exit(1);
+    }
+
+    uint64_t stored_checksum;
+    size_t checksum_offset = expected - sizeof(uint64_t);
+    memcpy(&stored_checksum, data + checksum_offset, sizeof(stored_checksum));
+    if (checksum(data, checksum_offset) != stored_checksum) {
+        cerr << "Weights file " << filename << " is corrupt (bad checksum)" << endl;
+        exit(1);
+    }
+
+    weight_intercept = header.intercept;
+    weights = (const int16_t *) (data + sizeof(header));
+}
+
+
+/**
+ * Writes the loaded weights in the binary format.
+ */
+void save_weights_binary(string filename) {
+    WeightsHeader header;
+    memcpy(header.magic, WEIGHTS_MAGIC, sizeof(header.magic));
+    header.version = WEIGHTS_VERSION;
+    header.n_weights = total_instances;
+    header.intercept = weight_intercept;
+
+    string data((const char *) &header, sizeof(header));
+    data.append((const char *) weights, total_instances * sizeof(int16_t));
+    uint64_t sum = checksum(data.data(), data.size());
+    data.append((const char *) &sum, sizeof(sum));
+
+    ofstream out(filename, ios::binary);
+    out.write(data.data(), data.size());
+    out.close();
+
+    if (!out) {
+        cerr << "Could not write weights file " << filename << endl;
+        exit(1);
+    }
 }
 
 
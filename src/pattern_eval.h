@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <string>
 
 #include "board.h"
@@ -8,71 +10,190 @@
 namespace eval {
 
 
-#define N_PATTERNS 9
-#define N_ALL_MASKS 34  // 4 for each pattern except diag8 (2)
+/* ====== PATTERN SET ====== */
 
+// Flips of the board that patterns are matched on.
+enum Flip { FLIP_NONE, FLIP_ADIAG, FLIP_VERT, FLIP_HORIZ, FLIP_DIAG, N_FLIPS };
 
-void pattern_activations(int *ret, board::Board b);
-int score(board::Board b);
+constexpr uint64_t flip_vert(uint64_t x) {
+    return __builtin_bswap64(x);
+}
 
-void load_weights(string filename);
+constexpr uint64_t flip_horiz(uint64_t x) {
+    const uint64_t k1 = 0x5555555555555555;
+    const uint64_t k2 = 0x3333333333333333;
+    const uint64_t k4 = 0x0f0f0f0f0f0f0f0f;
+    x = ((x >> 1) & k1) +  2*(x & k1);
+    x = ((x >> 2) & k2) +  4*(x & k2);
+    x = ((x >> 4) & k4) + 16*(x & k4);
+    return x;
+}
 
-uint64_t flip_vert(uint64_t x);
-uint64_t flip_horiz(uint64_t x);
-uint64_t flip_diag(uint64_t x);
-uint64_t flip_adiag(uint64_t x);
+constexpr uint64_t flip_diag(uint64_t x) {
+    uint64_t t = 0;
+    const uint64_t k1 = 0x5500550055005500;
+    const uint64_t k2 = 0x3333000033330000;
+    const uint64_t k4 = 0x0f0f0f0f00000000;
+    t  = k4 & (x ^ (x << 28));
+    x ^=       t ^ (t >> 28) ;
+    t  = k2 & (x ^ (x << 14));
+    x ^=       t ^ (t >> 14) ;
+    t  = k1 & (x ^ (x <<  7));
+    x ^=       t ^ (t >>  7) ;
+    return x;
+}
 
-inline uint64_t pext(uint64_t src, uint64_t mask);
+constexpr uint64_t flip_adiag(uint64_t x) {
+    uint64_t t = 0;
+    const uint64_t k1 = 0xaa00aa00aa00aa00;
+    const uint64_t k2 = 0xcccc0000cccc0000;
+    const uint64_t k4 = 0xf0f0f0f00f0f0f0f;
+    t  =       x ^ (x << 36) ;
+    x ^= k4 & (t ^ (x >> 36));
+    t  = k2 & (x ^ (x << 18));
+    x ^=       t ^ (t >> 18) ;
+    t  = k1 & (x ^ (x <<  9));
+    x ^=       t ^ (t >>  9) ;
+    return x;
+}
+
+constexpr uint64_t flip(uint64_t x, Flip f) {
+    switch (f) {
+        case FLIP_ADIAG: return flip_adiag(x);
+        case FLIP_VERT: return flip_vert(x);
+        case FLIP_HORIZ: return flip_horiz(x);
+        case FLIP_DIAG: return flip_diag(x);
+        default: return x;
+    }
+}
+
+// The flips a pattern is matched on. Each gives an instance of the pattern,
+// and all instances share the pattern's weights.
+struct Symmetry {
+    int n_flips;
+    Flip flips[8];
+};
+
+constexpr Symmetry DIAG_SYMMETRY = {4, {FLIP_NONE, FLIP_ADIAG, FLIP_VERT, FLIP_HORIZ}};
+constexpr Symmetry LONG_DIAG_SYMMETRY = {2, {FLIP_NONE, FLIP_VERT}};
+constexpr Symmetry EDGE_SYMMETRY = {4, {FLIP_NONE, FLIP_VERT, FLIP_DIAG, FLIP_ADIAG}};
 
+struct Pattern {
+    uint64_t mask;
+    Symmetry symmetry;
+};
 
-#define DIAG_4 0
-#define DIAG_5 1
-#define DIAG_6 2
-#define DIAG_7 3
-#define DIAG_8 4
-#define HORVERT_1 5
-#define HORVERT_2 6
-#define HORVERT_3 7
-#define HORVERT_4 8
-
-// Base set of patterns
-const uint64_t masks[N_PATTERNS] = {
-    0x1020408000000000, // diag 4
-    0x0810204080000000, // diag 5
-    0x0408102040800000, // diag 6
-    0x0204081020408000, // diag 7
-    0x0102040810204080, // diag 8
-    0xff00000000000000, // hor/vert 1
-    0x00ff000000000000, // hor/vert 2
-    0x0000ff0000000000, // hor/vert 3
-    0x000000ff00000000, // hor/vert 4
+// The pattern set. Weights are stored pattern by pattern in this order, with
+// one weight for each of the 3^n_bits ways a pattern can be filled. Offsets,
+// tables and the unrolled score function are all worked out from this list.
+constexpr Pattern patterns[] = {
+    {0x1020408000000000, DIAG_SYMMETRY},        // diag 4
+    {0x0810204080000000, DIAG_SYMMETRY},        // diag 5
+    {0x0408102040800000, DIAG_SYMMETRY},        // diag 6
+    {0x0204081020408000, DIAG_SYMMETRY},        // diag 7
+    {0x0102040810204080, LONG_DIAG_SYMMETRY},   // diag 8
+    {0xff00000000000000, EDGE_SYMMETRY},        // hor/vert 1
+    {0x00ff000000000000, EDGE_SYMMETRY},        // hor/vert 2
+    {0x0000ff0000000000, EDGE_SYMMETRY},        // hor/vert 3
+    {0x000000ff00000000, EDGE_SYMMETRY},        // hor/vert 4
 };
 
-// Number of instances each pattern can hold = 3^(n_bits)
-const uint16_t n_instances[N_PATTERNS] = { 81, 243, 729, 2187, 6561, 6561, 6561, 6561, 6561 };
+constexpr int N_PATTERNS = sizeof(patterns) / sizeof(patterns[0]);
 
-const uint16_t pattern_start[N_PATTERNS] = { 0, 81, 324, 1053, 3240, 9801, 16362, 22923, 29484 };
-const uint16_t total_instances = 36045; 
+constexpr int pattern_bits(int p) {
+    return __builtin_popcountll(patterns[p].mask);
+}
+
+constexpr int pow3(int n) {
+    int ret = 1;
+    for (int i = 0; i < n; i++) ret *= 3;
+    return ret;
+}
 
+constexpr std::array<int, N_PATTERNS + 1> make_pattern_start() {
+    std::array<int, N_PATTERNS + 1> ret = {};
+    for (int p = 0; p < N_PATTERNS; p++) ret[p + 1] = ret[p] + pow3(pattern_bits(p));
+    return ret;
+}
+
+// Index of each pattern's first weight, and the total number of weights.
+constexpr std::array<int, N_PATTERNS + 1> pattern_start = make_pattern_start();
+constexpr int total_instances = pattern_start[N_PATTERNS];
+
+static_assert(total_instances <= 65535, "weight indices must fit in 16 bits");
+
+constexpr int count_instances() {
+    int ret = 0;
+    for (int p = 0; p < N_PATTERNS; p++) ret += patterns[p].symmetry.n_flips;
+    return ret;
+}
+
+constexpr int N_ALL_MASKS = count_instances();
+constexpr int N_INDICES = (N_ALL_MASKS + 15) / 16 * 16;  // rounded up to whole AVX2 registers
+
+struct Instance {
+    int pattern;
+    Flip flip;
+};
+
+constexpr std::array<Instance, N_ALL_MASKS> make_instances() {
+    std::array<Instance, N_ALL_MASKS> ret = {};
+    int n = 0;
+    for (int p = 0; p < N_PATTERNS; p++) {
+        for (int f = 0; f < patterns[p].symmetry.n_flips; f++) {
+            ret[n++] = {p, patterns[p].symmetry.flips[f]};
+        }
+    }
+    return ret;
+}
+
+// Every pattern instance, in the order they are scored.
+constexpr std::array<Instance, N_ALL_MASKS> instances = make_instances();
+
+constexpr int max_pattern_bits() {
+    int ret = 0;
+    for (int p = 0; p < N_PATTERNS; p++) ret = std::max(ret, pattern_bits(p));
+    return ret;
+}
+
+constexpr std::array<uint16_t, 1 << max_pattern_bits()> make_ternary_ones() {
+    std::array<uint16_t, 1 << max_pattern_bits()> ret = {};
+    for (int bits = 0; bits < (int)ret.size(); bits++) {
+        for (int k = 0; k < max_pattern_bits(); k++) {
+            if ((bits >> k) & 1) ret[bits] += pow3(k);
+        }
+    }
+    return ret;
+}
 
 // Conversion from binary masks to ternary indices
-const uint16_t ternary_ones[256] = {
-    0,    1,    3,    4,    9,    10,   12,   13,   27,   28,   30,   31,   36,   37,   39,   40,
-    81,   82,   84,   85,   90,   91,   93,   94,   108,  109,  111,  112,  117,  118,  120,  121,
-    243,  244,  246,  247,  252,  253,  255,  256,  270,  271,  273,  274,  279,  280,  282,  283,
-    324,  325,  327,  328,  333,  334,  336,  337,  351,  352,  354,  355,  360,  361,  363,  364,
-    729,  730,  732,  733,  738,  739,  741,  742,  756,  757,  759,  760,  765,  766,  768,  769,
-    810,  811,  813,  814,  819,  820,  822,  823,  837,  838,  840,  841,  846,  847,  849,  850,
-    972,  973,  975,  976,  981,  982,  984,  985,  999,  1000, 1002, 1003, 1008, 1009, 1011, 1012,
-    1053, 1054, 1056, 1057, 1062, 1063, 1065, 1066, 1080, 1081, 1083, 1084, 1089, 1090, 1092, 1093,
-    2187, 2188, 2190, 2191, 2196, 2197, 2199, 2200, 2214, 2215, 2217, 2218, 2223, 2224, 2226, 2227,
-    2268, 2269, 2271, 2272, 2277, 2278, 2280, 2281, 2295, 2296, 2298, 2299, 2304, 2305, 2307, 2308,
-    2430, 2431, 2433, 2434, 2439, 2440, 2442, 2443, 2457, 2458, 2460, 2461, 2466, 2467, 2469, 2470,
-    2511, 2512, 2514, 2515, 2520, 2521, 2523, 2524, 2538, 2539, 2541, 2542, 2547, 2548, 2550, 2551,
-    2916, 2917, 2919, 2920, 2925, 2926, 2928, 2929, 2943, 2944, 2946, 2947, 2952, 2953, 2955, 2956,
-    2997, 2998, 3000, 3001, 3006, 3007, 3009, 3010, 3024, 3025, 3027, 3028, 3033, 3034, 3036, 3037,
-    3159, 3160, 3162, 3163, 3168, 3169, 3171, 3172, 3186, 3187, 3189, 3190, 3195, 3196, 3198, 3199,
-    3240, 3241, 3243, 3244, 3249, 3250, 3252, 3253, 3267, 3268, 3270, 3271, 3276, 3277, 3279, 3280
+constexpr std::array<uint16_t, 1 << max_pattern_bits()> ternary_ones = make_ternary_ones();
+
+
+/* ====== EVALUATION ====== */
+
+// Board with the index into weights of each of its pattern instances.
+// do_move updates only the instances that contain the placed square or a
+// flipped disc. Making a move swaps own and opp, so the indices of the board
+// seen from the other side are kept as well.
+struct PatternBoard {
+    board::Board b;
+    alignas(32) uint16_t idx[N_INDICES];
+    alignas(32) uint16_t idx_swapped[N_INDICES];
 };
 
+void pattern_activations(int *ret, board::Board b);
+int score(board::Board b);
+void score_batch(const board::Board *boards, int n, int *scores);
+
+PatternBoard patterned(board::Board b);
+PatternBoard do_move(const PatternBoard &pb, int pos);
+int score(const PatternBoard &pb);
+
+void load_weights(string filename);
+void load_weights_binary(string filename);
+void save_weights_binary(string filename);
+
+inline uint64_t pext(uint64_t src, uint64_t mask);
+
 }
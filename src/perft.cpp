@@ -1,28 +1,71 @@
 #include "board.h"
+#include "common.h"
 
 #include <iostream>
-#include <time.h>
+#include <string>
+#include <fmt/core.h>
+
+
+// Leaf counts from the starting position, with a pass counting as a ply and
+// finished games as one leaf.
+const long KNOWN_PERFT[] = {
+    1, 4, 12, 56, 244, 1396, 8200, 55092, 390216, 3005288, 24571284,
+    212258800, 1939886636, 18429641748
+};
+const int N_KNOWN_PERFT = sizeof(KNOWN_PERFT) / sizeof(KNOWN_PERFT[0]);
+
+
+/*
+ * Whether both versions of expand_children agree with do_move and get_moves.
+ */
+bool children_match(board::Board b) {
+    board::Board children[64], children_scalar[64];
+    int mobilities[64], mobilities_scalar[64];
+    uint64_t moves = board::expand_children(b, children, mobilities);
+    if (moves != board::get_moves_scalar(b)) return false;
+    if (board::expand_children_scalar(b, children_scalar, mobilities_scalar) != moves) return false;
+
+    int i = 0;
+    for (; moves != 0ULL; moves &= moves - 1, i++) {
+        board::Board child = board::do_move_scalar(b, __builtin_ctzll(moves));
+        int mobility = board::popcount(board::get_moves_scalar(child));
+        if (!(children[i] == child) || !(children_scalar[i] == child)) return false;
+        if (mobilities[i] != mobility || mobilities_scalar[i] != mobility) return false;
+    }
 
+    return true;
+}
 
-long perft(board::Board b, int depth, bool passed, bool print) {
-    uint64_t move_mask = board::get_moves(b);
 
+/*
+ * With check set, also compares move generation and make-move against their
+ * portable versions at every node, counting the nodes where they differ in
+ * mismatches.
+ */
+long perft(board::Board b, int depth, bool passed, bool check, long &mismatches) {
     if (depth == 0) {
-        /* if (print) cout << board::to_str(b) << "\n"; */
+        if (check && board::get_moves(b) != board::get_moves_scalar(b)) mismatches++;
         return 1;
     }
 
+    uint64_t move_mask = board::get_moves(b);
+    if (check && move_mask != board::get_moves_scalar(b)) mismatches++;
+
     if (move_mask == 0ULL) {
         if (passed) return 1;
-        return perft(board::Board{b.opp, b.own}, depth - 1, true, print);
+        return perft(board::Board{b.opp, b.own}, depth - 1, true, check, mismatches);
     }
 
-    int nodes = 0;
+    if (check && !children_match(b)) mismatches++;
+
+    long nodes = 0;
     while (move_mask != 0ULL) {
         int m = __builtin_ctzll(move_mask);
         move_mask &= move_mask - 1;
 
-        nodes += perft(board::do_move(b, m), depth - 1, false, print);
+        board::Board child = board::do_move(b, m);
+        if (check && !(child == board::do_move_scalar(b, m))) mismatches++;
+        nodes += perft(child, depth - 1, false, check, mismatches);
     }
 
     return nodes;
@@ -30,17 +73,19 @@ long perft(board::Board b, int depth, bool passed, bool print) {
 
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        cerr << "usage: perft DEPTH\n";
+    bool check = argc == 3 && string(argv[1]) == "--check";
+    if (argc != 2 && !check) {
+        cerr << "usage: perft [--check] DEPTH\n";
+        cerr << "--check compares move generation and make-move against their portable versions at every node.\n";
         exit(1);
     }
 
     int depth;
     try {
-        depth = std::stoi(argv[1]);
+        depth = std::stoi(argv[argc - 1]);
     } catch (const std::exception &) {
         cerr << "Couldn't parse DEPTH as int\n";
-        cerr << "usage: perft DEPTH\n";
+        cerr << "usage: perft [--check] DEPTH\n";
         exit(1);
     }
 
@@ -48,15 +93,23 @@ int main(int argc, char *argv[]) {
 
     cerr << "Counting nodes to depth " << depth << "\n";
 
-    clock_t start = clock();
-    
-    long nodes = perft(b, depth, false, true);
+    timestamp start = get_time();
+    long mismatches = 0;
+    long nodes = perft(b, depth, false, check, mismatches);
+    float time_spent = get_time_since(start);
+
+    fmt::print(stderr, "{} nodes\n", nodes);
+    fmt::print(stderr, "{:.3f}s @ {:.4e} node/s\n", time_spent, nodes / time_spent);
 
-    clock_t end = clock();
-    float time_spent = (float)(end - start) / CLOCKS_PER_SEC;
-    float nps = (float)nodes / time_spent;
-    cerr << nodes << " nodes\n";
-    cerr << time_spent << "s @ " << nps << " node/s\n";
+    bool ok = true;
+    if (depth >= 0 && depth < N_KNOWN_PERFT && nodes != KNOWN_PERFT[depth]) {
+        fmt::print(stderr, "Wrong count: expected {}\n", KNOWN_PERFT[depth]);
+        ok = false;
+    }
+    if (check) {
+        fmt::print(stderr, "{} positions where the vectorized and portable versions differ\n", mismatches);
+        ok = ok && mismatches == 0;
+    }
 
-    return 0;
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <fmt/core.h>
+
+#include "common.h"
+#include "pattern_eval.h"
+#include "training_data.h"
+
+
+struct TrainOptions {
+    int epochs;
+    int batch_size;
+    float learning_rate;
+    float l2;
+    float validation;
+    float scale;
+    int threads;
+    string weights_file;
+};
+
+const TrainOptions default_opts = {20, 4096, 0.01, 1e-6, 0.05, 500, 1, "weights.txt"};
+
+const float ADAM_BETA1 = 0.9;
+const float ADAM_BETA2 = 0.999;
+const float ADAM_EPSILON = 1e-8;
+
+
+void usage(char *argv[]) {
+    cerr << "Usage: " << argv[0] << " [-e EPOCHS] [-b BATCH] [-r RATE] [-l L2] [-v FRACTION] [-s SCALE] [-j THREADS] [-o WEIGHTS] DATA..." << endl << endl;
+    cerr << "Fits the pattern weights by logistic regression on whether the side to move won." << endl;
+    cerr << "DATA are features files from extract_features, or positions files from parse_games" << endl;
+    cerr << "or python/parse_wthor.py." << endl << endl;
+    cerr << "\t-e EPOCHS: passes over the training positions (int).\t"
+         << "Default: " << default_opts.epochs << endl;
+    cerr << "\t-b BATCH: positions per Adam step (int).\t\t"
+         << "Default: " << default_opts.batch_size << endl;
+    cerr << "\t-r RATE: Adam learning rate (float).\t\t\t"
+         << "Default: " << default_opts.learning_rate << endl;
+    cerr << "\t-l L2: L2 penalty on the weights (float).\t\t"
+         << "Default: " << default_opts.l2 << endl;
+    cerr << "\t-v FRACTION: positions held out for validation (float).\t"
+         << "Default: " << default_opts.validation << endl;
+    cerr << "\t-s SCALE: evaluation units per unit of log-odds (float).\t"
+         << "Default: " << default_opts.scale << endl;
+    cerr << "\t-j THREADS: threads computing gradients (int).\t\t"
+         << "Default: " << default_opts.threads << endl;
+    cerr << "\t-o WEIGHTS: write weights to WEIGHTS (str).\t\t"
+         << "Default: " << default_opts.weights_file << endl;
+}
+
+
+TrainOptions parse_opts(int argc, char *argv[]) {
+    TrainOptions ret = default_opts;
+
+    static struct option long_opts[] = {
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int optchar;
+    int optidx = 0;
+    while ((optchar = getopt_long(argc, argv, "he:b:r:l:v:s:j:o:", long_opts, &optidx)) != -1) {
+        switch (optchar) {
+            case 'e': ret.epochs = std::stoi(optarg); break;
+            case 'b': ret.batch_size = max(1, std::stoi(optarg)); break;
+            case 'r': ret.learning_rate = std::stof(optarg); break;
+            case 'l': ret.l2 = std::stof(optarg); break;
+            case 'v': ret.validation = std::stof(optarg); break;
+            case 's': ret.scale = std::stof(optarg); break;
+            case 'j': ret.threads = max(1, std::stoi(optarg)); break;
+            case 'o': ret.weights_file = optarg; break;
+            case 'h':
+                usage(argv);
+                exit(0);
+            default:
+                usage(argv);
+                exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv);
+        exit(1);
+    }
+
+    return ret;
+}
+
+
+/*
+ * Logistic model: the log-odds that the side to move wins are the intercept
+ * plus the weights of the position's pattern instances. Empty instances get
+ * no weight, as in python/train_patterns.py.
+ */
+struct Model {
+    vector<float> w = vector<float>(eval::total_instances, 0);
+    float b = 0;
+    vector<bool> trainable = vector<bool>(eval::total_instances, true);
+
+    Model() {
+        for (int p = 0; p < eval::N_PATTERNS; p++) trainable[eval::pattern_start[p]] = false;
+    }
+
+    float logit(const training::FeatureRecord &r) const {
+        float ret = b;
+        for (int i = 0; i < eval::N_ALL_MASKS; i++) ret += w[r.idx[i]];
+        return ret;
+    }
+};
+
+// Gradient of the summed loss over some positions, with their loss and number
+// predicted right.
+struct Gradient {
+    vector<float> w = vector<float>(eval::total_instances, 0);
+    float b = 0;
+    double loss = 0;
+    long correct = 0;
+
+    void clear() {
+        fill(w.begin(), w.end(), 0);
+        b = 0;
+        loss = 0;
+        correct = 0;
+    }
+};
+
+float label(const training::FeatureRecord &r) {
+    return r.score > 0 ? 1 : 0;
+}
+
+float sigmoid(float x) {
+    return 1 / (1 + exp(-x));
+}
+
+// Log loss from the logit, without overflowing for confident predictions.
+double log_loss(float logit, float y) {
+    return max(logit, 0.f) - logit * y + log1p(exp(-fabs(logit)));
+}
+
+
+/**
+ * Adds the gradient of the positions in [begin, end) to g. Only touches the
+ * weights of those positions' instances.
+ */
+void accumulate(const Model &m, const training::FeatureRecord *const *positions, size_t begin, size_t end, Gradient &g) {
+    for (size_t i = begin; i < end; i++) {
+        const training::FeatureRecord &r = *positions[i];
+        float z = m.logit(r);
+        float y = label(r);
+        float err = sigmoid(z) - y;
+
+        for (int k = 0; k < eval::N_ALL_MASKS; k++) g.w[r.idx[k]] += err;
+        g.b += err;
+        g.loss += log_loss(z, y);
+        g.correct += (z > 0) == (y > 0);
+    }
+}
+
+
+/**
+ * Runs accumulate over [begin, end), split between the calling thread and the
+ * pool's helpers, each into its own gradient.
+ */
+void accumulate_parallel(HelperPool &pool, const Model &m, const training::FeatureRecord *const *positions,
+                         size_t begin, size_t end, vector<Gradient> &grads) {
+    int n_threads = grads.size();
+    size_t chunk = (end - begin + n_threads - 1) / n_threads;
+
+    pool.start([&](int helper) {
+        int t = helper + 1;
+        size_t t_begin = min(end, begin + t * chunk);
+        size_t t_end = min(end, t_begin + chunk);
+        accumulate(m, positions, t_begin, t_end, grads[t]);
+    });
+    accumulate(m, positions, begin, min(end, begin + chunk), grads[0]);
+    pool.wait();
+}
+
+
+class Adam {
+public:
+    Adam(float learning_rate) : learning_rate(learning_rate) {}
+
+    // g is scaled by grad_scale, to turn sums over a batch into means.
+    void step(Model &m, const Gradient &g, float grad_scale, float l2) {
+        t++;
+        float correction1 = 1 - pow(ADAM_BETA1, t);
+        float correction2 = 1 - pow(ADAM_BETA2, t);
+        float rate = learning_rate * sqrt(correction2) / correction1;
+
+        for (int j = 0; j < eval::total_instances; j++) {
+            if (!m.trainable[j]) continue;
+            update(m.w[j], m_w[j], v_w[j], g.w[j] * grad_scale + l2 * m.w[j], rate);
+        }
+        update(m.b, m_b, v_b, g.b * grad_scale, rate);
+    }
+
+private:
+    static void update(float &x, float &m, float &v, float grad, float rate) {
+        m = ADAM_BETA1 * m + (1 - ADAM_BETA1) * grad;
+        v = ADAM_BETA2 * v + (1 - ADAM_BETA2) * grad * grad;
+        x -= rate * m / (sqrt(v) + ADAM_EPSILON);
+    }
+
+    float learning_rate;
+    int t = 0;
+    vector<float> m_w = vector<float>(eval::total_instances, 0);
+    vector<float> v_w = vector<float>(eval::total_instances, 0);
+    float m_b = 0;
+    float v_b = 0;
+};
+
+
+/**
+ * Writes the weights in the text format of eval::load_weights. The engine
+ * subtracts the intercept, so the negated intercept is written.
+ */
+void write_weights(const Model &m, const string &filename, float scale) {
+    auto to_int16 = [&](float x) {
+        return (int)max(-32767.f, min(32767.f, round(x * scale)));
+    };
+
+    ofstream out(filename);
+    out << -to_int16(m.b) << "\n";
+    for (int j = 0; j < eval::total_instances; j++) out << to_int16(m.w[j]) << "\n";
+    out.close();
+
+    if (!out) {
+        cerr << "Could not write weights file " << filename << endl;
+        exit(1);
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    TrainOptions opts = parse_opts(argc, argv);
+
+    vector<unique_ptr<training::FeatureSet>> sets;
+    vector<const training::FeatureRecord *> positions;
+    for (int i = optind; i < argc; i++) {
+        sets.push_back(make_unique<training::FeatureSet>(argv[i]));
+        for (size_t j = 0; j < sets.back()->size(); j++) positions.push_back(&(*sets.back())[j]);
+    }
+
+    mt19937 rng(1);
+    shuffle(positions.begin(), positions.end(), rng);
+
+    size_t n_valid = positions.size() * opts.validation;
+    size_t n_train = positions.size() - n_valid;
+    if (n_train == 0) {
+        cerr << "No positions to train on" << endl;
+        exit(1);
+    }
+
+    fmt::print(stderr, "{} training and {} validation positions, {} threads\n", n_train, n_valid, opts.threads);
+
+    Model model;
+    Adam adam(opts.learning_rate);
+    vector<Gradient> grads(opts.threads);
+    HelperPool pool(opts.threads - 1);
+    timestamp start = get_time();
+
+    for (int epoch = 1; epoch <= opts.epochs; epoch++) {
+        shuffle(positions.begin(), positions.begin() + n_train, rng);
+
+        double train_loss = 0;
+        long train_correct = 0;
+        for (size_t begin = 0; begin < n_train; begin += opts.batch_size) {
+            size_t end = min(n_train, begin + opts.batch_size);
+            for (auto &g : grads) g.clear();
+            accumulate_parallel(pool, model, positions.data(), begin, end, grads);
+
+            // Sum the threads' gradients into the first.
+            Gradient &total = grads[0];
+            for (int t = 1; t < opts.threads; t++) {
+                for (int j = 0; j < eval::total_instances; j++) total.w[j] += grads[t].w[j];
+                total.b += grads[t].b;
+                total.loss += grads[t].loss;
+                total.correct += grads[t].correct;
+            }
+
+            train_loss += total.loss;
+            train_correct += total.correct;
+            adam.step(model, total, 1. / (end - begin), opts.l2);
+        }
+
+        fmt::print(stderr, "epoch {:3}  train loss {:.4f} acc {:.4f}",
+                   epoch, train_loss / n_train, (double)train_correct / n_train);
+
+        if (n_valid > 0) {
+            for (auto &g : grads) g.clear();
+            accumulate_parallel(pool, model, positions.data(), n_train, positions.size(), grads);
+            double valid_loss = 0;
+            long valid_correct = 0;
+            for (auto &g : grads) {
+                valid_loss += g.loss;
+                valid_correct += g.correct;
+            }
+            fmt::print(stderr, "  valid loss {:.4f} acc {:.4f}", valid_loss / n_valid, (double)valid_correct / n_valid);
+        }
+
+        fmt::print(stderr, "  {:.1f}s\n", get_time_since(start));
+    }
+
+    write_weights(model, opts.weights_file, opts.scale);
+    fmt::print(stderr, "Wrote {}\n", opts.weights_file);
+}
@@ -0,0 +1,206 @@
+#include "training_data.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace training {
+
+
+const char FEATURES_MAGIC[4] = {'W', 'K', 'F', 'T'};
+const uint32_t FEATURES_VERSION = 1;
+
+const char POSITIONS_MAGIC[4] = {'W', 'K', 'P', 'S'};
+const uint32_t POSITIONS_VERSION = 1;
+
+// Records are written back to back, as Python's numpy reads them.
+static_assert(sizeof(FeatureRecord) == (eval::N_ALL_MASKS + 1) * sizeof(uint16_t), "FeatureRecord must not be padded");
+
+
+void write_positions(const std::string &filename, const std::vector<PositionRecord> &positions) {
+    PositionsHeader header;
+    memcpy(header.magic, POSITIONS_MAGIC, sizeof(header.magic));
+    header.version = POSITIONS_VERSION;
+    header.n_positions = positions.size();
+
+    ofstream out(filename, ios::binary);
+    out.write((const char *) &header, sizeof(header));
+    out.write((const char *) positions.data(), positions.size() * sizeof(PositionRecord));
+    out.close();
+
+    if (!out) {
+        cerr << "Could not write positions file " << filename << endl;
+        exit(1);
+    }
+}
+
+
+void read_positions(const std::string &filename, const std::function<void(board::Board, int)> &f) {
+    ifstream in(filename, ios::binary);
+    if (!in.is_open()) {
+        cerr << "Could not open positions file " << filename << endl;
+        exit(1);
+    }
+
+    PositionsHeader header = {};
+    in.read((char *) &header, sizeof(header));
+    if (memcmp(header.magic, POSITIONS_MAGIC, sizeof(header.magic)) == 0) {
+        if (header.version != POSITIONS_VERSION) {
+            cerr << "Positions file " << filename << " has the wrong version" << endl;
+            exit(1);
+        }
+
+        PositionRecord record;
+        for (uint64_t i = 0; i < header.n_positions; i++) {
+            if (!in.read((char *) &record, sizeof(record))) {
+                cerr << "Positions file " << filename << " is truncated" << endl;
+                exit(1);
+            }
+            f(board::Board{record.own, record.opp}, record.score);
+        }
+        return;
+    }
+
+    in.clear();
+    in.seekg(0);
+
+    string board_str;
+    int score;
+    while (in >> board_str >> score) {
+        if (board_str.size() != 64) {
+            cerr << "Bad position " << board_str << " in " << filename << endl;
+            exit(1);
+        }
+        f(board::from_str(board_str), score);
+    }
+
+    if (!in.eof()) {
+        cerr << "Bad line after " << board_str << " in " << filename << endl;
+        exit(1);
+    }
+}
+
+
+FeatureRecord make_record(board::Board b, int score) {
+    int idx[eval::N_ALL_MASKS];
+    eval::pattern_activations(idx, b);
+
+    FeatureRecord record;
+    for (int i = 0; i < eval::N_ALL_MASKS; i++) record.idx[i] = idx[i];
+    record.score = score;
+    return record;
+}
+
+
+FeatureWriter::FeatureWriter(const std::string &filename) : filename(filename), n_positions(0) {
+    file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        cerr << "Could not open features file " << filename << endl;
+        exit(1);
+    }
+
+    // Large buffer: records are small and there are millions of them.
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    FeaturesHeader header = {};
+    fwrite(&header, sizeof(header), 1, file);
+}
+
+
+FeatureWriter::~FeatureWriter() {
+    if (file) close();
+}
+
+
+void FeatureWriter::add(board::Board b, int score) {
+    FeatureRecord record = make_record(b, score);
+    fwrite(&record, sizeof(record), 1, file);
+    n_positions++;
+}
+
+
+/**
+ * Writes the header and closes the file. Gives the number of positions.
+ */
+uint64_t FeatureWriter::close() {
+    FeaturesHeader header;
+    memcpy(header.magic, FEATURES_MAGIC, sizeof(header.magic));
+    header.version = FEATURES_VERSION;
+    header.n_indices = eval::N_ALL_MASKS;
+    header.n_weights = eval::total_instances;
+    header.n_positions = n_positions;
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+
+    bool failed = ferror(file);
+    failed |= fclose(file) != 0;
+    file = nullptr;
+
+    if (failed) {
+        cerr << "Could not write features file " << filename << endl;
+        exit(1);
+    }
+
+    return n_positions;
+}
+
+
+/**
+ * Opens a features file, or extracts the features of a positions file (see
+ * read_positions). Features files are told apart by their magic number. Features files are mapped and used in place, and are checked
+ * against the engine's pattern set.
+ */
+FeatureSet::FeatureSet(const std::string &filename) : records(nullptr), n_positions(0), mapping(nullptr), mapping_bytes(0) {
+    char magic[4] = {};
+    ifstream(filename, ios::binary).read(magic, sizeof(magic));
+    if (memcmp(magic, FEATURES_MAGIC, sizeof(magic)) != 0) {
+        read_positions(filename, [&](board::Board b, int score) { extracted.push_back(make_record(b, score)); });
+        records = extracted.data();
+        n_positions = extracted.size();
+        return;
+    }
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FeaturesHeader)) {
+        cerr << "Could not open features file " << filename << endl;
+        exit(1);
+    }
+
+    mapping_bytes = st.st_size;
+    mapping = mmap(nullptr, mapping_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "Could not map features file " << filename << endl;
+        exit(1);
+    }
+
+    FeaturesHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    if (header.version != FEATURES_VERSION || header.n_indices != eval::N_ALL_MASKS
+            || header.n_weights != eval::total_instances) {
+        cerr << "Features file " << filename << " was made for another version or pattern set" << endl;
+        exit(1);
+    }
+    if (mapping_bytes != sizeof(header) + header.n_positions * sizeof(FeatureRecord)) {
+        cerr << "Features file " << filename << " is truncated" << endl;
+        exit(1);
+    }
+
+    records = (const FeatureRecord *) ((const char *) mapping + sizeof(header));
+    n_positions = header.n_positions;
+}
+
+
+FeatureSet::~FeatureSet() {
+    if (mapping) munmap(mapping, mapping_bytes);
+}
+
+
+}
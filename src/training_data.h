@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "board.h"
+#include "pattern_eval.h"
+
+
+namespace training {
+
+/*
+ * Training positions as the weight indices of their pattern instances, in
+ * native byte order:
+ *   FeaturesHeader
+ *   FeatureRecord records[n_positions]
+ *
+ * A position's evaluation is -intercept plus the sum of the weights at its
+ * indices, so a trainer only needs to read these back.
+ */
+struct FeaturesHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t n_indices;     // per position, N_ALL_MASKS
+    uint32_t n_weights;     // total_instances, to catch a changed pattern set
+    uint64_t n_positions;
+};
+
+struct FeatureRecord {
+    uint16_t idx[eval::N_ALL_MASKS];
+    int16_t score;          // final disc difference for the side to move
+};
+
+/*
+ * Deduplicated positions from game databases, in native byte order:
+ *   PositionsHeader
+ *   PositionRecord records[n_positions]
+ *
+ * Boards are from the side to move, and score is the side to move's final
+ * disc difference, averaged over the games the position was reached in.
+ */
+struct PositionsHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t n_positions;
+};
+
+struct __attribute__((packed)) PositionRecord {
+    uint64_t own;
+    uint64_t opp;
+    int8_t score;
+    uint8_t count;          // games the position was reached in, up to 255
+};
+
+void write_positions(const std::string &filename, const std::vector<PositionRecord> &positions);
+
+// Calls f on every position of a positions file, or of a text file of
+// "BOARD SCORE" lines as written by python/parse_wthor.py: X is the side to
+// move and SCORE its final disc difference.
+void read_positions(const std::string &filename, const std::function<void(board::Board, int)> &f);
+
+// Streams records to a features file. The position count in the header is
+// filled in by close.
+class FeatureWriter {
+public:
+    FeatureWriter(const std::string &filename);
+    ~FeatureWriter();
+    FeatureWriter(const FeatureWriter &) = delete;
+    FeatureWriter &operator=(const FeatureWriter &) = delete;
+    void add(board::Board b, int score);
+    uint64_t close();
+private:
+    std::string filename;
+    FILE *file;
+    uint64_t n_positions;
+};
+
+// Training positions, mapped from a features file in place, or extracted from
+// a positions file.
+class FeatureSet {
+public:
+    FeatureSet(const std::string &filename);
+    ~FeatureSet();
+    FeatureSet(const FeatureSet &) = delete;
+    FeatureSet &operator=(const FeatureSet &) = delete;
+    const FeatureRecord &operator[](size_t i) const { return records[i]; }
+    size_t size() const { return n_positions; }
+private:
+    const FeatureRecord *records;
+    size_t n_positions;
+    void *mapping;
+    size_t mapping_bytes;
+    std::vector<FeatureRecord> extracted;
+};
+
+}